@@ -54,8 +54,10 @@ static INLINE void disb() {
 
 /* Data cache clean and invalidate by virtual address to point of coherency. */
 static INLINE void dccivac(void *p, int n) {
-    while (n--)
-        asm volatile("dc civac, %[x]" : : [x] "r"(p + n));
+    u64 begin = (u64)p & ~(u64)(CACHE_LINE_SIZE - 1);
+    u64 end = (u64)p + (u64)n;
+    for (u64 x = begin; x < end; x += CACHE_LINE_SIZE)
+        asm volatile("dc civac, %[x]" : : [x] "r"(x));
 }
 
 /* Read Exception Syndrome Register (EL1). */
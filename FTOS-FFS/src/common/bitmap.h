@@ -42,3 +42,100 @@ static INLINE void bitmap_clear(BitmapCell *bitmap, usize index) {
     BITMAP_PARSE_INDEX(index, idx, offset);
     bitmap[idx] &= ~BIT(offset);
 }
+
+// the following operations work on whole cells rather than single bits.
+// `__builtin_ctzll` and `__builtin_popcountll` are compiled to `rbit`/`clz`
+// and `cnt` on AArch64.
+
+// find the first cleared bit in `[begin, size)`. Return `size` if not found.
+static INLINE usize bitmap_find_next_zero(BitmapCell *bitmap, usize size, usize begin) {
+    if (begin >= size)
+        return size;
+
+    usize idx, offset;
+    BITMAP_PARSE_INDEX(begin, idx, offset);
+
+    // set bits in `cell` are cleared bits in bitmap.
+    BitmapCell cell = ~bitmap[idx] & (~(BitmapCell)0 << offset);
+    usize num_cells = BITMAP_TO_NUM_CELLS(size);
+    while (cell == 0) {
+        if (++idx >= num_cells)
+            return size;
+        cell = ~bitmap[idx];
+    }
+
+    usize index = idx * BITMAP_BITS_PER_CELL + (usize)__builtin_ctzll(cell);
+    return index < size ? index : size;
+}
+
+// find the first set bit in `[begin, size)`. Return `size` if not found.
+static INLINE usize bitmap_find_next_set(BitmapCell *bitmap, usize size, usize begin) {
+    if (begin >= size)
+        return size;
+
+    usize idx, offset;
+    BITMAP_PARSE_INDEX(begin, idx, offset);
+
+    BitmapCell cell = bitmap[idx] & (~(BitmapCell)0 << offset);
+    usize num_cells = BITMAP_TO_NUM_CELLS(size);
+    while (cell == 0) {
+        if (++idx >= num_cells)
+            return size;
+        cell = bitmap[idx];
+    }
+
+    usize index = idx * BITMAP_BITS_PER_CELL + (usize)__builtin_ctzll(cell);
+    return index < size ? index : size;
+}
+
+// find the first cleared bit in `[0, size)`. Return `size` if not found.
+static INLINE usize bitmap_find_first_zero(BitmapCell *bitmap, usize size) {
+    return bitmap_find_next_zero(bitmap, size, 0);
+}
+
+// return a cell mask of `n` bits starting at `offset`, where `n > 0`.
+static INLINE BitmapCell bitmap_cell_mask(usize offset, usize n) {
+    BitmapCell mask = n >= BITMAP_BITS_PER_CELL ? ~(BitmapCell)0 : BIT(n) - 1;
+    return mask << offset;
+}
+
+// count set bits in `[begin, end)`.
+static INLINE usize bitmap_count(BitmapCell *bitmap, usize begin, usize end) {
+    usize count = 0;
+    while (begin < end) {
+        usize idx, offset;
+        BITMAP_PARSE_INDEX(begin, idx, offset);
+        usize n = BITMAP_BITS_PER_CELL - offset;
+        if (n > end - begin)
+            n = end - begin;
+        count += (usize)__builtin_popcountll(bitmap[idx] & bitmap_cell_mask(offset, n));
+        begin += n;
+    }
+    return count;
+}
+
+// set all bits in `[begin, end)` to 1.
+static INLINE void bitmap_set_range(BitmapCell *bitmap, usize begin, usize end) {
+    while (begin < end) {
+        usize idx, offset;
+        BITMAP_PARSE_INDEX(begin, idx, offset);
+        usize n = BITMAP_BITS_PER_CELL - offset;
+        if (n > end - begin)
+            n = end - begin;
+        bitmap[idx] |= bitmap_cell_mask(offset, n);
+        begin += n;
+    }
+}
+
+// set all bits in `[begin, end)` to 0.
+static INLINE void bitmap_clear_range(BitmapCell *bitmap, usize begin, usize end) {
+    while (begin < end) {
+        usize idx, offset;
+        BITMAP_PARSE_INDEX(begin, idx, offset);
+        usize n = BITMAP_BITS_PER_CELL - offset;
+        if (n > end - begin)
+            n = end - begin;
+        bitmap[idx] &= ~bitmap_cell_mask(offset, n);
+        begin += n;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <common/defines.h>
+
+// 32-bit FNV-1a hash, which is used to detect torn writes of on-disk data.
+// start with `CHECKSUM_INIT` and feed data into `checksum` piece by piece.
+#define CHECKSUM_INIT 0x811c9dc5u
+
+// update `hash` with `size` bytes at `data`, and return the new hash.
+static INLINE u32 checksum(u32 hash, const void *data, usize size) {
+    const u8 *p = (const u8 *)data;
+    for (usize i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
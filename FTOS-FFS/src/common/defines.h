@@ -42,6 +42,9 @@ typedef u64 usize;
 #define ALWAYS_INLINE inline __attribute__((unused, always_inline))
 #define NO_INLINE     __attribute__((noinline))
 
+// cache line size of Cortex-A53.
+#define CACHE_LINE_SIZE 64
+
 // NOTE: no_return will disable traps.
 NO_RETURN NO_INLINE void no_return();
 
@@ -76,14 +76,12 @@ void *alloc_object(Arena *arena) {
     // find an empty slot in page.
     ArenaPage *page = arena->pages;
     void *object = NULL;
-    for (usize index = 0; index < arena->max_count; index++) {
-        if (bitmap_get(page->used, index) == false) {
-            object = page->data + index * arena->object_size;
-            bitmap_set(page->used, index);
-            page->count++;
-            arena->num_objects++;
-            break;
-        }
+    usize index = bitmap_find_first_zero(page->used, arena->max_count);
+    if (index < arena->max_count) {
+        object = page->data + index * arena->object_size;
+        bitmap_set(page->used, index);
+        page->count++;
+        arena->num_objects++;
     }
 
     asserts(object != NULL, "arena failed to allocate object");
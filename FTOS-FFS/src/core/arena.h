@@ -23,7 +23,8 @@ typedef struct {
     usize count;
 
     // flexible array member: <https://en.wikipedia.org/wiki/Flexible_array_member>
-    u8 data[];
+    // objects are cache-line aligned if their sizes are multiples of cache line size.
+    u8 data[] __attribute__((aligned(CACHE_LINE_SIZE)));
 } ArenaPage;
 
 #define ARENA_PAGE_CAPACITY (ARENA_PAGE_SIZE - sizeof(ArenaPage))
@@ -32,7 +32,7 @@ int execve(const char *path, char *const argv[], char *const envp[]) {
     // trace("path='%s', argv=0x%p, envp=0x%p", s, argv, envp);
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, 0);
     ip = namei(path, &ctx);
     if (ip == 0) {
         bcache.end_op(&ctx);
@@ -88,6 +88,43 @@ void spawn_init_process() {
     p->state = RUNNABLE;
 }
 
+static SpinLock flusher_lock;
+
+/*
+ * Kernel thread that commits the block cache log once
+ * BCACHE_COMMIT_INTERVAL has passed, so that committed atomic
+ * operations do not stay in memory when no more operations end.
+ * It sleeps between clock ticks and never returns to user space.
+ */
+static void flusher() {
+    release_sched_lock();
+    while (1) {
+        bcache.commit_if_due();
+
+        acquire_spinlock(&flusher_lock);
+        sleep(&flusher_lock, &flusher_lock);
+        release_spinlock(&flusher_lock);
+    }
+}
+
+/*
+ * Set up the flusher thread. The file system must be initialized.
+ */
+void spawn_flusher() {
+    struct proc *p;
+    init_spinlock(&flusher_lock, "flusher");
+    p = alloc_proc();
+    p->context->lr0 = (u64)flusher;
+    p->state = RUNNABLE;
+}
+
+/*
+ * Called by the clock handler on every tick.
+ */
+void wakeup_flusher() {
+    wakeup(&flusher_lock);
+}
+
 /*
  * A fork child will first swtch here, and then "return" to user space.
  */
@@ -95,8 +132,9 @@ void forkret() {
     release_sched_lock();
     if (!__atomic_test_and_set(&flag_atom, 1)) {
         init_filesystem();
+        spawn_flusher();
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, 0);
         thiscpu()->proc->cwd = namei("/", &ctx);
         bcache.end_op(&ctx);
         // sd_test();
@@ -122,7 +160,7 @@ NO_RETURN void exit() {
         }
     }
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, inodes.put_log_blocks(thiscpu()->proc->cwd));
     inodes.put(&ctx, thiscpu()->proc->cwd);
     bcache.end_op(&ctx);
 
@@ -50,6 +50,8 @@ NO_RETURN void exit();
 void sleep(void *chan, SpinLock *lock);
 void wakeup(void *chan);
 void idle_init();
+void spawn_flusher();
+void wakeup_flusher();
 int growproc(int n);
 int wait();
 int fork();
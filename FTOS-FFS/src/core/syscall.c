@@ -54,6 +54,8 @@ int (*syscall_table[NR_SYSCALL])() = {[0 ... NR_SYSCALL - 1] = sys_default,
                                       [SYS_read] = (int (*)())sys_read,
                                       [SYS_write] = (int (*)())sys_write,
                                       [SYS_close] = sys_close,
+                                      [SYS_sync] = sys_sync,
+                                      [SYS_fsync] = sys_fsync,
                                       [SYS_myyield] = sys_yield,
                                       [228] = sys_ctime};
 
@@ -81,6 +83,8 @@ const char(*syscall_table_str[NR_SYSCALL]) = {[0 ... NR_SYSCALL - 1] = "sys_defa
                                               [SYS_read] = "sys_read",
                                               [SYS_write] = "sys_write",
                                               [SYS_close] = "sys_close",
+                                              [SYS_sync] = "sys_sync",
+                                              [SYS_fsync] = "sys_fsync",
                                               [SYS_myyield] = "sys_yield",
                                               [228] = "sys_ctime"};
 
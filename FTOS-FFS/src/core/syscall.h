@@ -21,6 +21,8 @@ isize sys_writev();
 int sys_close();
 int sys_fstat();
 int sys_fstatat();
+int sys_sync();
+int sys_fsync();
 Inode *create(char *path, short type, short major, short minor, OpContext *ctx);
 int sys_openat();
 int sys_mkdirat();
@@ -167,6 +167,39 @@ int sys_fstat() {
     return filestat(f, st);
 }
 
+/*
+ * Commit all finished file system operations to disk.
+ */
+int sys_sync() {
+    inodes.flush_all();
+    bcache.flush();
+    return 0;
+}
+
+/*
+ * Write out delayed data of the file first. Atomic operations are
+ * checkpointed as a whole, so syncing one file syncs everything.
+ */
+int sys_fsync() {
+    struct file *f;
+
+    if (argfd(0, 0, &f) < 0) {
+        return -1;
+    }
+
+    if (f->type == FD_INODE) {
+        OpContext ctx;
+        bcache.begin_op(&ctx, INODE_FLUSH_LOG_BLOCKS);
+        inodes.lock(f->ip);
+        inodes.flush(&ctx, f->ip);
+        inodes.unlock(f->ip);
+        bcache.end_op(&ctx);
+    }
+
+    bcache.flush();
+    return 0;
+}
+
 int sys_fstatat() {
     i32 dirfd, flags;
     char *path;
@@ -187,7 +220,7 @@ int sys_fstatat() {
 
     Inode *ip;
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, 0);
     if ((ip = namei(path, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
@@ -205,10 +238,16 @@ static int namecmp(const char *s, const char *t) {
     return strncmp(s, t, FILE_NAME_MAX_LENGTH);
 }
 
+/*
+ * Log entries of unlink(): the directory entry, and the i-nodes of the
+ * parent and the target. Dropping the last link may also free the
+ * target, see INODE_FREE_LOG_BLOCKS.
+ */
+#define UNLINK_LOG_BLOCKS (INODE_REMOVE_LOG_BLOCKS + 2)
+
 int sys_unlink()
 {
     Inode *ip, *dp;
-    struct dirent de;
     char name[FILE_NAME_MAX_LENGTH], *path;
     usize off;
 
@@ -220,7 +259,9 @@ int sys_unlink()
 
     // 开始一次原子操作
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    usize num_blocks = UNLINK_LOG_BLOCKS;
+retry:
+    bcache.begin_op(&ctx, num_blocks);
     // 待删除对象不存在父目录，异常直接退出
     if((dp = nameiparent(path, name, &ctx)) == 0){
         bcache.end_op(&ctx);
@@ -243,6 +284,17 @@ int sys_unlink()
     if(ip->entry.num_links < 1)
         PANIC("unlink: nlink < 1");
 
+    // 删除最后一个链接时待删除对象可能随之释放，预留的日志项不足则重新开始
+    if(ip->entry.num_links == 1 && num_blocks < UNLINK_LOG_BLOCKS + INODE_FREE_LOG_BLOCKS){
+        inodes.unlock(ip);
+        inodes.put(&ctx, ip);
+        inodes.unlock(dp);
+        inodes.put(&ctx, dp);
+        bcache.end_op(&ctx);
+        num_blocks = UNLINK_LOG_BLOCKS + INODE_FREE_LOG_BLOCKS;
+        goto retry;
+    }
+
     // printf("dp->entry.num_links: %d\n", dp->entry.num_links);
     
     // 无法删除非空文件夹
@@ -253,9 +305,7 @@ int sys_unlink()
     }
 
     // 删除待删除对象在父目录中的项
-    memset(&de, 0, sizeof(de));
-    if(inodes.write(&ctx, dp, (u8*)&de, off * sizeof(de), sizeof(de)) != sizeof(de))
-        PANIC("unlink: inode_write");
+    inodes.remove(&ctx, dp, off);
     // 待删除对象为目录类型，父目录需要额外减少num_links
     // 即删除对象内包含父目录的硬链接，删除对象后这一链接丢失
     if(ip->entry.type == INODE_DIRECTORY){
@@ -284,6 +334,14 @@ bad:
     return -1;
 }    
 
+/*
+ * Log entries of create(): allocating the i-node and inserting its name
+ * into the parent. A new directory also gets "." and "..", and updates
+ * the link count of the parent.
+ */
+#define CREATE_LOG_BLOCKS (INODE_ALLOC_LOG_BLOCKS + INODE_INSERT_LOG_BLOCKS)
+#define MKDIR_LOG_BLOCKS  (CREATE_LOG_BLOCKS + INODE_INSERT_LOG_BLOCKS + 1)
+
 Inode *create(char *path, short type, short major, short minor, OpContext *ctx) {
     /* TODO: Your code here. */
     u32 off;
@@ -373,7 +431,7 @@ int sys_openat() {
     // }
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, (omode & O_CREAT) ? CREATE_LOG_BLOCKS : 0);
     if (omode & O_CREAT) {
         // FIXME: Support acl mode.
         ip = create(path, INODE_REGULAR, 0, 0, &ctx);
@@ -430,7 +488,7 @@ int sys_mkdirat() {
         return -1;
     }
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, MKDIR_LOG_BLOCKS);
     if ((ip = create(path, INODE_DIRECTORY, 0, 0, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
@@ -456,7 +514,7 @@ int sys_mknodat() {
     printf("mknodat: path '%s', major:minor %d:%d\n", path, major, minor);
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, CREATE_LOG_BLOCKS);
     if ((ip = create(path, INODE_DEVICE, (i16)major, (i16)minor, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
@@ -472,8 +530,9 @@ int sys_chdir() {
     Inode *ip;
     struct proc *curproc = thiscpu()->proc;
 
+    // only the old working directory may be freed, if it has been removed.
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, inodes.put_log_blocks(curproc->cwd));
     if (argstr(0, &path) < 0 || (ip = namei(path, &ctx)) == 0) {
         bcache.end_op(&ctx);
         return -1;
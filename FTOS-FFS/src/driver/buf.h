@@ -12,38 +12,22 @@
 struct buf {
     int flags;
     u32 blockno;
-    u8 data[BSIZE];  // 1B*512
 
-    /* TODO: Your code here. */
-    struct buf *qnext;
-};
+    // `nblocks` contiguous sectors beginning at `blockno` are transferred
+    // from/to `data`, which holds at least `nblocks * BSIZE` bytes. There is no
+    // copy in between. `data` must be word-aligned. For DMA, it should also be
+    // cache-line aligned, unless nobody writes to the memory around it.
+    u32 nblocks;
+    u8 *data;
+
+    u32 ndone;  // number of sectors transferred so far, maintained by the driver.
 
-static INLINE void init_buflist(struct buf *head) {
-    head->blockno = 0;
-    head->flags = 0;
-    memset(head->data, 0, sizeof(head->data));
-    head->qnext = NULL;
-}
-
-static INLINE void buflist_push(struct buf *n, struct buf *head) {
-    struct buf *tmp = head;
-    while (tmp->qnext != NULL)
-        tmp = tmp->qnext;
-
-    tmp->qnext = n;
-    n->qnext = NULL;
-}
-
-static INLINE struct buf *buflist_front(struct buf *head)  //head != NULL
-{
-    return head->qnext;
-}
-
-static INLINE void buflist_pop(struct buf *head)  //head != NULL
-{
-    head->qnext = (head->qnext)->qnext;
-}
-
-static INLINE int buflist_empty(struct buf *head) {
-    return (head->qnext == NULL);
-}
+    // maintained by the driver.
+    ListNode node;      // in the pending queue of the driver, or in a batch for `sd_submit`.
+    struct buf *mnext;  // next request merged into the same command.
+    u32 deadline;       // dispatched no later than this, see `SD_DEADLINE`.
+
+    // optional, called by the driver in interrupt context when the request
+    // completes. It must not sleep.
+    void (*callback)(struct buf *b);
+};
@@ -37,3 +37,7 @@ void invoke_clock_handler() {
 
     ctx.handler();
 }
+
+u64 get_time_ms() {
+    return get_timestamp() / (get_clock_frequency() / 1000);
+}
@@ -8,3 +8,6 @@ void init_clock();
 void reset_clock(u64 countdown_ms);
 void set_clock_handler(ClockHandler handler);
 void invoke_clock_handler();
+
+// milliseconds elapsed since the system counter started.
+u64 get_time_ms();
@@ -0,0 +1,68 @@
+#include <driver/dma.h>
+
+#include <aarch64/arm.h>
+#include <aarch64/intrinsic.h>
+#include <core/console.h>
+
+#define DMA_BASE            (MMIO_BASE + 0x7000)
+#define DMA_CS(chan)        (DMA_BASE + 0x100 * (u64)(chan) + 0x00)
+#define DMA_CONBLK_AD(chan) (DMA_BASE + 0x100 * (u64)(chan) + 0x04)
+#define DMA_DEBUG(chan)     (DMA_BASE + 0x100 * (u64)(chan) + 0x20)
+#define DMA_ENABLE          (DMA_BASE + 0xFF0)
+
+#define DMA_CS_ACTIVE   (1 << 0)
+#define DMA_CS_END      (1 << 1)
+#define DMA_CS_INT      (1 << 2)
+#define DMA_CS_ERROR    (1 << 8)
+#define DMA_CS_PRIORITY(x)       ((x) << 16)
+#define DMA_CS_PANIC_PRIORITY(x) ((x) << 20)
+#define DMA_CS_WAIT_WRITES       (1 << 28)
+#define DMA_CS_RESET    (1u << 31)
+
+/* Clear error flags in DEBUG register. */
+#define DMA_DEBUG_CLEAR 0x7
+
+/* Enable and reset channel `chan`. */
+void dma_init(int chan) {
+    asserts(0 <= chan && chan < 15, "invalid dma channel %d. ", chan);
+    device_put_u32(DMA_ENABLE, device_get_u32(DMA_ENABLE) | (1u << chan));
+    device_put_u32(DMA_CS(chan), DMA_CS_RESET);
+    while (device_get_u32(DMA_CS(chan)) & DMA_CS_RESET) {}
+    device_put_u32(DMA_DEBUG(chan), DMA_DEBUG_CLEAR);
+}
+
+/* Start the transfer described by `n` control blocks in `cbs` on idle channel `chan`. */
+void dma_start(int chan, DMAControlBlock *cbs, int n) {
+    asserts(!dma_busy(chan), "dma channel %d is busy. ", chan);
+    asserts(n > 0, "empty dma transfer. ");
+
+    for (int i = 0; i < n; i++)
+        cbs[i].nextconbk = i + 1 < n ? BUS_MEMORY(&cbs[i + 1]) : 0;
+
+    // The engine reads control blocks from memory, not from our cache.
+    dccivac(cbs, (int)(sizeof(*cbs) * (usize)n));
+    disb();
+
+    device_put_u32(DMA_CS(chan), DMA_CS_END | DMA_CS_INT);
+    device_put_u32(DMA_CONBLK_AD(chan), BUS_MEMORY(cbs));
+    device_put_u32(DMA_CS(chan),
+                   DMA_CS_ACTIVE | DMA_CS_PRIORITY(8) | DMA_CS_PANIC_PRIORITY(15) |
+                       DMA_CS_WAIT_WRITES);
+}
+
+/* Is channel `chan` still transferring? */
+bool dma_busy(int chan) {
+    return (device_get_u32(DMA_CS(chan)) & DMA_CS_ACTIVE) != 0;
+}
+
+/*
+ * Wait for the tail of the transfer on channel `chan`.
+ * Callers only wait after the peripheral reports completion, so this is short.
+ */
+void dma_wait(int chan) {
+    while (dma_busy(chan)) {}
+
+    u32 cs = device_get_u32(DMA_CS(chan));
+    asserts(!(cs & DMA_CS_ERROR), "dma channel %d error: 0x%x. ", chan, device_get_u32(DMA_DEBUG(chan)));
+    device_put_u32(DMA_CS(chan), DMA_CS_END | DMA_CS_INT);
+}
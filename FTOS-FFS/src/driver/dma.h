@@ -0,0 +1,41 @@
+/* See BCM2837 ARM Peripherals, chapter 4 "DMA Controller". */
+#pragma once
+
+#include <aarch64/mmu.h>
+#include <common/defines.h>
+#include <driver/base.h>
+
+/* DMA channel owned by the SD driver. */
+#define DMA_CHANNEL_EMMC 4
+
+/* Peripheral number of EMMC, which paces transfers with its DREQ signal. */
+#define DMA_PERMAP_EMMC 11
+
+/* Transfer information (TI) fields of a control block. */
+#define DMA_TI_INTEN       (1 << 0)
+#define DMA_TI_WAIT_RESP   (1 << 3)
+#define DMA_TI_DEST_INC    (1 << 4)
+#define DMA_TI_DEST_DREQ   (1 << 6)
+#define DMA_TI_SRC_INC     (1 << 8)
+#define DMA_TI_SRC_DREQ    (1 << 10)
+#define DMA_TI_PERMAP(x)   ((x) << 16)
+
+/* Bus addresses seen by the DMA engine. Memory goes through the uncached alias. */
+#define BUS_MEMORY(addr)     ((u32)(K2P(addr) | 0xC0000000))
+#define BUS_PERIPHERAL(addr) ((u32)((u64)(addr) - MMIO_BASE + 0x7E000000))
+
+/* A control block must be 32-byte aligned. */
+typedef struct {
+    u32 ti;
+    u32 source_ad;
+    u32 dest_ad;
+    u32 txfr_len;
+    u32 stride;
+    u32 nextconbk;
+    u32 reserved[2];
+} __attribute__((aligned(32))) DMAControlBlock;
+
+void dma_init(int chan);
+void dma_start(int chan, DMAControlBlock *cbs, int n);
+bool dma_busy(int chan);
+void dma_wait(int chan);
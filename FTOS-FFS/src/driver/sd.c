@@ -25,11 +25,13 @@
 #include <core/proc.h>
 #include <driver/buf.h>
 #include <driver/clock.h>
+#include <driver/dma.h>
 #include <driver/interrupt.h>
 #include <driver/uart.h>
 
 // Private functions.
 static void sd_start(struct buf *b);
+static void sd_finish(struct buf *b);
 static void sd_delayus(u32 cnt);
 static int sdInit();
 static void sdParseCID();
@@ -258,12 +260,12 @@ static EMMCCommand sdCommandTable[] = {
     {"GO_INACTIVE", 0x0F000000 | CMD_RSPNS_NO, RESP_NO, RCA_YES, 0},
     {"SET_BLOCKLEN", 0x10000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"READ_SINGLE", 0x11000000 | CMD_RSPNS_48 | CMD_IS_DATA | TM_DAT_DIR_CH, RESP_R1, RCA_NO, 0},
-    {"READ_MULTI", 0x12000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_DAT_DIR_CH, RESP_R1, RCA_NO, 0},
+    {"READ_MULTI", 0x12000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_AUTO_CMD12 | TM_DAT_DIR_CH, RESP_R1, RCA_NO, 0},
     {"SEND_TUNING", 0x13000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"SPEED_CLASS", 0x14000000 | CMD_RSPNS_48B, RESP_R1b, RCA_NO, 0},
     {"SET_BLOCKCNT", 0x17000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"WRITE_SINGLE", 0x18000000 | CMD_RSPNS_48 | CMD_IS_DATA | TM_DAT_DIR_HC, RESP_R1, RCA_NO, 0},
-    {"WRITE_MULTI", 0x19000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_DAT_DIR_HC, RESP_R1, RCA_NO, 0},
+    {"WRITE_MULTI", 0x19000000 | CMD_RSPNS_48 | TM_MULTI_DATA | TM_AUTO_CMD12 | TM_DAT_DIR_HC, RESP_R1, RCA_NO, 0},
     {"PROGRAM_CSD", 0x1B000000 | CMD_RSPNS_48, RESP_R1, RCA_NO, 0},
     {"SET_WRITE_PR", 0x1C000000 | CMD_RSPNS_48B, RESP_R1b, RCA_NO, 0},
     {"CLR_WRITE_PR", 0x1D000000 | CMD_RSPNS_48B, RESP_R1b, RCA_NO, 0},
@@ -498,9 +500,14 @@ static int sdBaseClock;
  * See https://en.wikipedia.org/wiki/Master_boot_record
  */
 
-struct buf sdque;
 struct SpinLock sdlock;
 
+// All states below are protected by sdlock.
+static ListNode sdque;         // pending requests in arrival order.
+static struct buf *sdactive;   // the command in flight, merged requests on `mnext`.
+static u32 sdpos;              // the block after the last dispatched command.
+static u32 sdseq;              // number of dispatched commands.
+
 void sd_init() {
     /*
      * Initialize the lock and request queue if any.
@@ -508,12 +515,17 @@ void sd_init() {
      */
     /* TODO: Your code here. */
     static struct buf mbr;
+    static u8 mbr_data[BSIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
     u32 LBA;
     u32 NUM;
     // u8 *end;
 
     init_spinlock(&sdlock, "sdlock");
-    init_buflist(&sdque);
+    init_list_node(&sdque);
+    sdactive = NULL;
+    sdpos = 0;
+    sdseq = 0;
+    dma_init(DMA_CHANNEL_EMMC);
 
     sdInit();
     assert(sdCard.init);
@@ -532,18 +544,13 @@ void sd_init() {
 
     mbr.blockno = 0;
     mbr.flags = 0;
-    mbr.qnext = NULL;
+    mbr.nblocks = 1;
+    mbr.data = mbr_data;
+    mbr.mnext = NULL;
 
     sd_start(&mbr);
-
-    sdWaitForInterrupt(INT_READ_RDY);
-
-    u32 *intbuf = (u32 *)mbr.data;
-    for (int done = 0; done < 128;) {
-        intbuf[done++] = *EMMC_DATA;
-        // printf("%d %d\n", intbuf[done - 1], done - 1);
-    }
     sdWaitForInterrupt(INT_DATA_DONE);
+    sd_finish(&mbr);
 
     //no.471-474 475-478 bytes 4bytes
     LBA = *(u32 *)(mbr.data + 0x1CE + 0x8);
@@ -559,7 +566,10 @@ static void sd_delayus(u32 c) {
     delayus(c * 3);
 }
 
-/* Start the request for b. Caller must hold sdlock. */
+/*
+ * Start the command for b and the requests merged after it on `mnext`, which
+ * cover contiguous sectors in the same direction. Caller must hold sdlock.
+ */
 static void sd_start(struct buf *b) {
     // Address is different depending on the card type.
     // HC pass address as block #.
@@ -574,115 +584,253 @@ static void sd_start(struct buf *b) {
     asserts(!*EMMC_INTERRUPT, "emmc interrupt flag should be empty: 0x%x. ", *EMMC_INTERRUPT);
     disb();
 
+    // Data is moved between memory and EMMC_DATA by the DMA engine, paced by
+    // the DREQ of EMMC, so that CPU is free while the transfer is in flight.
+    // Each request has its own control block, and they are chained.
+    static DMAControlBlock cbs[SD_MAX_MERGE];
+    int n = 0;
+    u32 nblocks = 0;
+    for (struct buf *r = b; r; r = r->mnext, n++) {
+        asserts(n < SD_MAX_MERGE, "too many merged requests. ");
+        u8 *data = r->data;
+        u32 len = r->nblocks * BSIZE;
+        asserts((((i64)data) & 0x03) == 0, "Only support word-aligned buffers. ");
+
+        // Write back dirty lines of the buffer for writes, and make sure that no
+        // dirty line will be evicted over the DMA result for reads.
+        dccivac(data, (int)len);
+
+        DMAControlBlock *cb = &cbs[n];
+        if (write) {
+            cb->ti = DMA_TI_SRC_INC | DMA_TI_DEST_DREQ | DMA_TI_WAIT_RESP |
+                     DMA_TI_PERMAP(DMA_PERMAP_EMMC);
+            cb->source_ad = BUS_MEMORY(data);
+            cb->dest_ad = BUS_PERIPHERAL(EMMC_DATA);
+        } else {
+            cb->ti = DMA_TI_DEST_INC | DMA_TI_SRC_DREQ | DMA_TI_WAIT_RESP |
+                     DMA_TI_PERMAP(DMA_PERMAP_EMMC);
+            cb->source_ad = BUS_PERIPHERAL(EMMC_DATA);
+            cb->dest_ad = BUS_MEMORY(data);
+        }
+        cb->txfr_len = len;
+        cb->stride = 0;
+
+        r->ndone = 0;
+        nblocks += r->nblocks;
+    }
+    disb();
+
     // Work out the status, interrupt and command values for the transfer.
-    int cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
+    // A multi-block transfer is ended by the controller with auto CMD12.
+    asserts(nblocks >= 1 && nblocks <= SD_MAX_MULTI_BLOCKS, "invalid block count %u. ", nblocks);
+    int cmd;
+    if (nblocks > 1)
+        cmd = write ? IX_WRITE_MULTI : IX_READ_MULTI;
+    else
+        cmd = write ? IX_WRITE_SINGLE : IX_READ_SINGLE;
 
     int resp;
-    *EMMC_BLKSIZECNT = 512;
+    *EMMC_BLKSIZECNT = (nblocks << 16) | 512;
+    dma_start(DMA_CHANNEL_EMMC, cbs, n);
 
     if ((resp = sdSendCommandA(cmd, bno))) {
         PANIC("* EMMC send command error.");
     }
+}
+
+/* Complete the command started by sd_start(b) after INT_DATA_DONE. Caller must hold sdlock. */
+static void sd_finish(struct buf *b) {
+    // EMMC is done, but DMA may still be draining the last words of the FIFO.
+    dma_wait(DMA_CHANNEL_EMMC);
 
-    int done = 0;
-    u32 *intbuf = (u32 *)b->data;
-    asserts((((i64)b->data) & 0x03) == 0, "Only support word-aligned buffers. ");
+    for (struct buf *r = b; r; r = r->mnext) {
+        // Drop the lines that CPU may have speculatively fetched during the transfer.
+        if (!(r->flags & B_DIRTY))
+            dccivac(r->data, (int)(r->nblocks * BSIZE));
+
+        r->ndone = r->nblocks;
+        r->flags |= B_VALID;
+        r->flags &= ~B_DIRTY;
+    }
+    disb();
+}
+
+/* Can request r be appended to the command of `count` sectors starting at `first`? */
+static bool sd_mergeable(struct buf *first, u32 count, struct buf *r) {
+    return (r->flags & B_DIRTY) == (first->flags & B_DIRTY) &&
+           r->blockno == first->blockno + count &&
+           count + r->nblocks <= SD_MAX_MULTI_BLOCKS;
+}
+
+/*
+ * Pick the next command from the pending queue and start it.
+ * Caller must hold sdlock, and no command is in flight.
+ */
+static void sd_dispatch() {
+    if (sdque.next == &sdque) {
+        sdactive = NULL;
+        return;
+    }
 
-    if (write) {
-        // Wait for ready interrupt for the next block.
-        if ((resp = sdWaitForInterrupt(INT_WRITE_RDY))) {
-            PANIC("* EMMC ERROR: Timeout waiting for ready to write\n");
-            // return sdDebugResponse(resp);
+    // The oldest request goes first if it has waited long enough. Otherwise,
+    // sweep upward from the last position (C-SCAN), wrapping to the lowest block.
+    struct buf *oldest = container_of(sdque.next, struct buf, node);
+    struct buf *next = NULL, *lowest = NULL;
+    if ((int)(sdseq - oldest->deadline) >= 0)
+        next = oldest;
+    else {
+        for (ListNode *p = sdque.next; p != &sdque; p = p->next) {
+            struct buf *r = container_of(p, struct buf, node);
+            if (r->blockno >= sdpos && (!next || r->blockno < next->blockno))
+                next = r;
+            if (!lowest || r->blockno < lowest->blockno)
+                lowest = r;
+        }
+        if (!next)
+            next = lowest;
+    }
+    detach_from_list(&next->node);
+    next->mnext = NULL;
+
+    // Merge pending requests that continue the command.
+    struct buf *last = next;
+    u32 count = next->nblocks;
+    for (int n = 1; n < SD_MAX_MERGE;) {
+        struct buf *found = NULL;
+        for (ListNode *p = sdque.next; p != &sdque; p = p->next) {
+            struct buf *r = container_of(p, struct buf, node);
+            if (sd_mergeable(next, count, r)) {
+                found = r;
+                break;
+            }
         }
-        asserts(!*EMMC_INTERRUPT, "%d ", *EMMC_INTERRUPT);
-        while (done < 128)
-            *EMMC_DATA = intbuf[done++];
+        if (!found)
+            break;
+
+        detach_from_list(&found->node);
+        found->mnext = NULL;
+        last->mnext = found;
+        last = found;
+        count += found->nblocks;
+        n++;
     }
+
+    sdactive = next;
+    sdpos = next->blockno + count;
+    sdseq++;
+    sd_start(next);
 }
 
 /* The interrupt handler. */
 void sd_intr() {
-    /* TODO: Your code here. */
-
-    /* Hint: Example pseudocode is provided as below. */
     acquire_spinlock(&sdlock);
-    if (buflist_empty(&sdque)) {
+    if (!sdactive) {
         printf("sd receive redundent interrupt 0x%x, omitted.\n", *EMMC_INTERRUPT);
     } else {
         int i = (int)(*EMMC_INTERRUPT);
         // FIXME: Restart when failed
-        asserts((i & INT_DATA_DONE) || (i & INT_READ_RDY), "unexpected sd intr");
+        asserts((i & INT_DATA_DONE) || (i & INT_ERROR_MASK), "unexpected sd intr");
 
         *EMMC_INTERRUPT = (u32)i;  // Clear interrupt.
         disb();
 
-        struct buf *b = buflist_front(&sdque);
-        int write = b->flags & B_DIRTY;
-        if (!((write && i == INT_DATA_DONE) || (!write && i == INT_READ_RDY))) {
-            sd_start(b);
+        // INT_READ_RDY and INT_WRITE_RDY may be latched during a DMA transfer.
+        if (i & INT_ERROR_MASK) {
+            dma_init(DMA_CHANNEL_EMMC);
+            sd_start(sdactive);
             // FIXME: don't PANIC
             printf("sd intr unexpected: 0x%x, restarted.\n", i);
         } else {
-            if (!write) {
-                u32 *intbuf = (u32 *)b->data;
-                for (int done = 0; done < 128;)
-                    intbuf[done++] = *EMMC_DATA;
-                sdWaitForInterrupt(INT_DATA_DONE);
+            sd_finish(sdactive);
+            for (struct buf *r = sdactive, *next; r; r = next) {
+                // `r` may be reused by its owner once the callback returns.
+                next = r->mnext;
+                if (r->callback)
+                    r->callback(r);
+                wakeup(r);
             }
 
-            b->flags |= B_VALID;
-            b->flags &= ~B_DIRTY;
-            wakeup(b);
-
-            buflist_pop(&sdque);
-            if (!buflist_empty(&sdque))
-                sd_start(buflist_front(&sdque));
+            sd_dispatch();
         }
     }
     release_spinlock(&sdlock);
 }
 
+/*
+ * Queue the requests for b and the bufs linked after it through their
+ * nodes, and return without waiting for them. The whole batch is queued
+ * before a command is dispatched, so that it can be sorted and merged.
+ * The callback of each buf is invoked when its request completes, if any.
+ */
+void sd_submit(struct buf *b) {
+    acquire_spinlock(&sdlock);
+
+    ListNode *p = &b->node;
+    do {
+        struct buf *r = container_of(p, struct buf, node);
+        r->ndone = 0;
+        r->deadline = sdseq + SD_DEADLINE;
+        p = p->next;
+    } while (p != &b->node);
+    merge_list(sdque.prev, &b->node);
+
+    if (!sdactive)
+        sd_dispatch();
+
+    release_spinlock(&sdlock);
+}
+
+/* Wait for the request for b, which is submitted by sd_submit. */
+void sd_wait(struct buf *b) {
+    acquire_spinlock(&sdlock);
+    while (b->ndone < b->nblocks)
+        sleep((void *)b, &sdlock);
+    release_spinlock(&sdlock);
+}
+
 /*
  * Sync buf with disk.
  * If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
  * Else if B_VALID is not set, read buf from disk, set B_VALID.
  */
 void sdrw(struct buf *b) {
-    /* TODO: Your code here. */
-    // add to the list, if list is empty, then use sd_start
-    // then sleep, use loop to check whether buf flag is modified, if modified, then break
-    int flag;
-    // printf("sdrw called\n");
-    flag = buflist_empty(&sdque);
-    buflist_push(b, &sdque);
-
-    acquire_spinlock(&sdlock);
-
-    if (flag) {
-        sd_start(buflist_front(&sdque));
-    }
+    b->callback = NULL;
+    init_list_node(&b->node);
+    sd_submit(b);
+    sd_wait(b);
+}
 
-    while (1) {
-        sleep((void *)b, &sdlock);
-        //flags = 100 -> 010
-        if ((b->flags & B_VALID) && (~b->flags & B_DIRTY)) {
-            break;
-        }
-    }
-    if (holding_spinlock(&sdlock))
-        release_spinlock(&sdlock);
+/* Print the result of a benchmark. */
+static void sd_report(const char *what, i64 nbytes, i64 t, i64 f) {
+    i64 mb = nbytes >> 20;
+    printf("- %s %lldB (%lldMB), t: %lld cycles, speed: %lld.%lld MB/s\n",
+           what,
+           nbytes,
+           mb,
+           t,
+           mb * f / t,
+           (mb * f * 10 / t) % 10);
 }
 
 /* SD card test and benchmark. */
 void sd_test() {
     static struct buf b[1 << 11];
+    static u8 bdata[1 << 11][BSIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+    static u8 mbuf[(1 << 11) * BSIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+    static struct buf mb_req;
     int n = sizeof(b) / sizeof(b[0]);
     int mb = (n * BSIZE) >> 20;
+    int m = 64;  // sectors per multi-block request.
     assert(mb);
     i64 f, t;
     asm volatile("mrs %[freq], cntfrq_el0" : [freq] "=r"(f));
     printf("- sd test: begin nblocks %d\n", n);
 
+    for (int i = 0; i < n; i++) {
+        b[i].nblocks = 1;
+        b[i].data = bdata[i];
+    }
+
     printf("- sd check rw...\n");
     // Read/write test
     for (int i = 1; i < n; i++) {
@@ -698,7 +846,7 @@ void sd_test() {
             b[i].data[j] = (u8)((i * j) & 0xFF);
         sdrw(&b[i]);
 
-        memset(b[i].data, 0, sizeof(b[i].data));
+        memset(b[i].data, 0, BSIZE);
         // Read back and check
         b[i].flags = 0;
         sdrw(&b[i]);
@@ -722,12 +870,7 @@ void sd_test() {
     disb();
     t = (i64)timestamp() - t;
     disb();
-    printf("- read %lldB (%lldMB), t: %lld cycles, speed: %lld.%lld MB/s\n",
-           n * BSIZE,
-           mb,
-           t,
-           mb * f / t,
-           (mb * f * 10 / t) % 10);
+    sd_report("read", n * BSIZE, t, f);
 
     // Write benchmark
     disb();
@@ -741,13 +884,42 @@ void sd_test() {
     disb();
     t = (i64)timestamp() - t;
     disb();
+    sd_report("write", n * BSIZE, t, f);
 
-    printf("- write %lldB (%lldMB), t: %lld cycles, speed: %lld.%lld MB/s\n",
-           n * BSIZE,
-           mb,
-           t,
-           mb * f / t,
-           (mb * f * 10 / t) % 10);
+    // Multi-block read benchmark, checked against the single-block reads above.
+    disb();
+    t = (i64)timestamp();
+    disb();
+    for (int i = 0; i < n; i += m) {
+        mb_req.flags = 0;
+        mb_req.blockno = (u32)i;
+        mb_req.nblocks = (u32)m;
+        mb_req.data = mbuf + i * BSIZE;
+        sdrw(&mb_req);
+    }
+    disb();
+    t = (i64)timestamp() - t;
+    disb();
+    for (int i = 0; i < n; i++) {
+        assert(memcmp(mbuf + i * BSIZE, b[i].data, BSIZE) == 0);
+    }
+    sd_report("multi-block read", n * BSIZE, t, f);
+
+    // Multi-block write benchmark, which writes back the same content.
+    disb();
+    t = (i64)timestamp();
+    disb();
+    for (int i = 0; i < n; i += m) {
+        mb_req.flags = B_DIRTY;
+        mb_req.blockno = (u32)i;
+        mb_req.nblocks = (u32)m;
+        mb_req.data = mbuf + i * BSIZE;
+        sdrw(&mb_req);
+    }
+    disb();
+    t = (i64)timestamp() - t;
+    disb();
+    sd_report("multi-block write", n * BSIZE, t, f);
 }
 
 static int sdDebugResponse(int resp) {
@@ -1195,8 +1367,10 @@ static int sdResetCard(int resetType) {
     // Enable interrupts for command completion values.
     // *EMMC_IRPT_EN   = INT_ALL_MASK;
     // *EMMC_IRPT_MASK = INT_ALL_MASK;
-    // Ignore INT_CMD_DONE and INT_WRITE_RDY.
-    *EMMC_IRPT_EN = 0xffffffff & (u32)(~INT_CMD_DONE) & (~(u32)INT_WRITE_RDY);
+    // Ignore INT_CMD_DONE, INT_READ_RDY and INT_WRITE_RDY, since data is moved by DMA
+    // and only INT_DATA_DONE is interesting to the interrupt handler.
+    *EMMC_IRPT_EN = 0xffffffff & (u32)(~INT_CMD_DONE) & (~(u32)INT_READ_RDY) &
+                    (~(u32)INT_WRITE_RDY);
     *EMMC_IRPT_MASK = 0xffffffff;
     // printf("EMMC: Interrupt enable/mask registers: %08x %08x\n",*EMMC_IRPT_EN,*EMMC_IRPT_MASK);
     // printf("EMMC: Status: %08x, control: %08x %08x %08x\n",*EMMC_STATUS,*EMMC_CONTROL0,*EMMC_CONTROL1,*EMMC_CONTROL2);
@@ -18,7 +18,21 @@
 #define SD_READ_BLOCKS  0
 #define SD_WRITE_BLOCKS 1
 
+// maximum number of sectors of one multi-block request, limited by the
+// 16-bit block count field of EMMC_BLKSIZECNT.
+#define SD_MAX_MULTI_BLOCKS 0xFFFF
+
+// maximum number of requests merged into one command.
+#define SD_MAX_MERGE 32
+
+// pending requests are served in ascending order of block numbers, but a
+// request is dispatched before others once `SD_DEADLINE` commands have been
+// dispatched since it was queued.
+#define SD_DEADLINE 16
+
 void sd_init();
 void sd_intr();
 void sd_test();
 void sdrw(struct buf *);
+void sd_submit(struct buf *);
+void sd_wait(struct buf *);
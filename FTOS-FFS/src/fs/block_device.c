@@ -4,30 +4,73 @@
 // TODO: we should read this value from MBR block.
 #define BLOCKNO_OFFSET (0x20800)
 
+// NOTE: SD driver transfers directly from/to `buffer`, which should be
+// cache-line aligned, see `struct buf`.
+
 static void sd_read(usize block_no, u8 *buffer) {
     struct buf b;
     b.blockno = (u32)block_no + BLOCKNO_OFFSET;
     b.flags = 0;
+    b.nblocks = 1;
+    b.data = buffer;
     sdrw(&b);
-    memcpy(buffer, b.data, sizeof(b.data));
 }
 
 static void sd_write(usize block_no, u8 *buffer) {
     struct buf b;
     b.blockno = (u32)block_no + BLOCKNO_OFFSET;
     b.flags = B_DIRTY | B_VALID;
-    memcpy(b.data, buffer, sizeof(b.data));
+    b.nblocks = 1;
+    b.data = buffer;
     sdrw(&b);
 }
 
-static u8 sblock_data[BLOCK_SIZE];
+// called by SD driver when the request of `b` completes.
+static void sd_complete(struct buf *b) {
+    BlockRequest *req = container_of(b, BlockRequest, buf);
+    if (req->callback)
+        req->callback(req);
+    __atomic_store_n(&req->done, true, __ATOMIC_RELEASE);
+}
+
+// link the bufs of all requests, so that the driver queues them at once.
+static void sd_submit_requests(BlockRequest **reqs, usize count) {
+    if (count == 0)
+        return;
+
+    struct buf *first = &reqs[0]->buf;
+    for (usize i = 0; i < count; i++) {
+        BlockRequest *req = reqs[i];
+        struct buf *b = &req->buf;
+        req->done = false;
+        b->blockno = (u32)req->block_no + BLOCKNO_OFFSET;
+        b->flags = req->write ? B_DIRTY | B_VALID : 0;
+        b->nblocks = 1;
+        b->data = req->buffer;
+        b->callback = sd_complete;
+        init_list_node(&b->node);
+        if (i > 0)
+            merge_list(first->node.prev, &b->node);
+    }
+    sd_submit(first);
+}
+
+static bool sd_poll(BlockRequest *req) {
+    return __atomic_load_n(&req->done, __ATOMIC_ACQUIRE);
+}
+
+static void sd_wait_request(BlockRequest *req) {
+    sd_wait(&req->buf);
+}
+
+static u8 sblock_data[BLOCK_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
 BlockDevice block_device;
 
 void init_block_device() {
     sd_init();
 
     usize sd_num;
-    usize sd_size = (sizeof(struct buf) - 16);
+    usize sd_size = BSIZE;
     usize sd_start = SECTS_PER_BLOCK;
 
     for (sd_num = 0; sd_num < BLOCK_SIZE / sd_size; sd_num++) {
@@ -35,6 +78,9 @@ void init_block_device() {
     }
     block_device.read = sd_read;
     block_device.write = sd_write;
+    block_device.submit = sd_submit_requests;
+    block_device.poll = sd_poll;
+    block_device.wait = sd_wait_request;
 }
 
 const SuperBlock *get_super_block() {
@@ -1,7 +1,26 @@
 #pragma once
 
+#include <driver/buf.h>
 #include <fs/defines.h>
 
+struct BlockRequest;
+
+// called when a request completes. It may run in interrupt context, so it
+// must not sleep.
+typedef void (*BlockCallback)(struct BlockRequest *req);
+
+// an asynchronous request to read/write one block, see `submit`.
+typedef struct BlockRequest {
+    usize block_no;
+    u8 *buffer;              // `BLOCK_SIZE` bytes to read into or to write from.
+    bool write;              // write `buffer` to disk if true, otherwise read.
+    BlockCallback callback;  // optional.
+    void *arg;               // for `callback`.
+
+    bool done;       // set by the device when the request completes.
+    struct buf buf;  // private to the device.
+} BlockRequest;
+
 typedef struct {
     // read `BLOCK_SIZE` bytes in block at `block_no` to `buffer`.
     // caller must guarantee `buffer` is large enough.
@@ -10,6 +29,18 @@ typedef struct {
     // write `BLOCK_SIZE` bytes from `buffer` to block at `block_no`.
     // caller must guarantee `buffer` contains at least `BLOCK_SIZE` bytes.
     void (*write)(usize block_no, u8 *buffer);
+
+    // start `count` requests pointed by `reqs` and return without waiting for
+    // them. Requests may complete in any order. Once a request completes,
+    // `callback` is invoked and then `done` is set.
+    // the caller must keep requests and their buffers alive until they complete.
+    void (*submit)(BlockRequest **reqs, usize count);
+
+    // return whether `req` has completed.
+    bool (*poll)(BlockRequest *req);
+
+    // wait until `req` completes.
+    void (*wait)(BlockRequest *req);
 } BlockDevice;
 
 extern BlockDevice block_device;
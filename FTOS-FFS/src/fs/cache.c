@@ -1,32 +1,142 @@
 #include <common/bitmap.h>
+#include <common/checksum.h>
 #include <common/string.h>
 #include <core/arena.h>
 #include <core/console.h>
 #include <core/physical_memory.h>
 #include <core/proc.h>
+#include <driver/clock.h>
 #include <fs/cache.h>
 #include <fs/used_block.h>
 
 static const SuperBlock *sblock;
 static const BlockDevice *device;
 
-static SpinLock lock;     // protects block cache.
-static Arena arena;       // memory pool for `Block` struct.
-static ListNode head;     // the list of all allocated in-memory block.
-static LogHeader header;  // in-memory copy of log header block.
+// a ghost entry of ARC, which only remembers the number of an evicted block.
+typedef struct {
+    usize block_no;
+    ListNode node;   // in ghost list B1 or B2.
+    ListNode chain;  // in the ghost hash bucket of its shard.
+    u8 list;         // 0 for B1 and 1 for B2.
+} Ghost;
+
+// a shard of block cache. blocks are distributed to shards by `block_no`.
+typedef struct {
+    SpinLock lock;                         // protects this shard and blocks in it.
+    ListNode buckets[BCACHE_NUM_BUCKETS];  // hash table of all blocks in this shard.
+    usize num_blocks;                      // number of blocks in this shard.
+    usize capacity;                        // number of blocks this shard should hold.
+
+    // CLOCK: all blocks form a ring, and `hand` points to the next candidate.
+    ListNode ring;
+    ListNode *hand;
+
+    // ARC: resident lists T1/T2 and ghost lists B1/B2, from LRU to MRU.
+    // `target` is the adaptive target size of T1, i.e. `p` in the ARC paper.
+    ListNode t[2], b[2];
+    usize num_t[2], num_b[2];
+    usize target;
+    ListNode ghosts[BCACHE_NUM_BUCKETS];
+} CacheShard;
+
+// replacement policy of block cache.
+// NOTE: all functions are called with the lock of `shard` held.
+typedef struct {
+    // reset policy states of an empty shard.
+    void (*init)(CacheShard *shard);
+
+    // drop all policy states of a shard whose blocks are all dropped.
+    void (*clear)(CacheShard *shard);
+
+    // `block` is found in cache by `acquire`.
+    void (*hit)(CacheShard *shard, Block *block);
+
+    // `block_no` is not in cache. Return an evictable block that is taken out
+    // of policy lists to be reused, or NULL if a new block should be allocated.
+    Block *(*evict)(CacheShard *shard, usize block_no);
+
+    // `block` now caches `block->block_no` and becomes resident in `shard`.
+    void (*insert)(CacheShard *shard, Block *block);
+} ReplacementPolicy;
+
+static SpinLock lock;       // protects logging states below.
+static Arena arena;         // memory pool for `Block` struct.
+static Arena ghost_arena;   // memory pool for `Ghost` struct.
+static CacheShard shards[BCACHE_NUM_SHARDS];
+static const ReplacementPolicy *policy;
+static usize num_cached;    // number of allocated `Block` struct, updated atomically.
+// in-memory copy of log header block, i.e. the group of atomic operations
+// being checkpointed.
+static LogHeader header __attribute__((aligned(CACHE_LINE_SIZE)));
+// log entries of atomic operations committed after the last group commit.
+static LogHeader pending;
+// for writing the log header together with logged blocks.
+static BlockRequest header_req;
 
 static usize last_allocated_ts;  // last timestamp assigned by `begin_op`.
 static usize last_persisted_ts;  // last timestamp of atomic operation that is persisted to disk.
 
-static usize log_start;  // the block number that is next to the log header block.
+static usize log_start;     // the block number that is next to the log header block.
+static usize log_capacity;  // number of blocks in logging area, except the header.
 static usize log_size;   // maximum number of blocks that can be recorded in log.
 static usize log_used;   // number of log entries reserved/used by uncommitted atomic operations.
 
 static usize op_count;  // number of outstanding atomic operations that are not ended by `end_op`.
 
+static bool checkpointing;    // is a group being checkpointed?
+static bool flush_requested;  // set by `flush` to force the next group commit.
+static usize num_waiting;     // number of `begin_op` waiting for log space.
+static u64 last_commit_time;  // time (in ms) of last group commit.
+
 // first defined here
 u32 used_block[NGROUPS] = {0};
 
+// 每个块组的内存分配状态，连同`used_block`一起由块组各自的锁保护，
+// 因此不同块组中的分配可以并行进行。位图本身的修改由位图块的锁串行化
+typedef struct {
+    SpinLock lock;
+
+    // 分配游标，即下一次在该块组内查找空闲块的起始组内偏移
+    // 游标只是查找提示，因此不需要持久化
+    u32 rotor;
+
+    // 该块组中最长空闲区间长度的上界，作为内存中的空闲区间索引
+    // 扫描整个块组都找不到足够长的区间时更新为实际的最长长度，
+    // 释放的块在检查点后变为可分配时重置为块组大小
+    // `alloc_extent`据此跳过无法满足请求的块组
+    u32 largest_free;
+
+    // 释放的块变为可分配的次数，用于判断扫描期间`largest_free`是否已失效
+    u32 num_frees;
+
+    // 空闲数据块数，即块组描述符中空闲块数的内存副本
+    // 分配和释放只修改这里，组提交时才由`write_group_desc`写入描述符表
+    u32 num_free_blocks;
+
+    // `num_free_blocks`在上次组提交之后是否被修改过
+    bool dirty;
+
+    // 已释放但释放尚未检查点的块，每个位图块对应一个`FreedBlocks`
+    ListNode freed;
+} AllocGroup;
+
+static AllocGroup groups[NGROUPS];
+
+// 块组中一个位图块范围内已释放、但释放尚未检查点的块
+// 它们在位图中已经清零，但在检查点之前不能再分配：数据块的内容不经过日志直接写入，
+// 若释放提交之前就被重新分配并写入，崩溃后原文件仍指向该块，会读到新文件的数据
+typedef struct {
+    ListNode node;  // in `freed` of its group.
+    usize index;    // index of the bitmap block in its group.
+
+    // freed by atomic operations after the last group commit.
+    Bitmap(freeing, BIT_PER_BLOCK);
+    // freed in the group being checkpointed, and released after `checkpoint`.
+    Bitmap(committing, BIT_PER_BLOCK);
+} FreedBlocks;
+
+static Arena freed_arena;  // memory pool for `FreedBlocks` struct.
+
 // read the content from disk.
 static INLINE void device_read(Block *block) {
     device->read(block->block_no, block->data);
@@ -37,6 +147,37 @@ static INLINE void device_write(Block *block) {
     device->write(block->block_no, block->data);
 }
 
+// fill a device request without callback.
+static INLINE void init_request(BlockRequest *req, usize block_no, u8 *buffer, bool write) {
+    req->block_no = block_no;
+    req->buffer = buffer;
+    req->write = write;
+    req->callback = NULL;
+}
+
+// maximum number of device requests that cache keeps in flight at once.
+#define IO_BATCH_SIZE 32
+
+// read/write `count` blocks from/to disk with all requests in flight at the
+// same time. `blocks[i]->data` is transferred from/to `block_nos[i]` if
+// `block_nos` is not NULL, or `blocks[i]->block_no` otherwise.
+//
+// NOTE: the caller must hold the locks of all blocks.
+static void device_rw(Block **blocks, const usize *block_nos, usize count, bool write) {
+    BlockRequest *reqs[IO_BATCH_SIZE];
+    assert(count <= IO_BATCH_SIZE);
+
+    for (usize i = 0; i < count; i++) {
+        reqs[i] = &blocks[i]->req;
+        init_request(reqs[i], block_nos ? block_nos[i] : blocks[i]->block_no, blocks[i]->data, write);
+    }
+
+    device->submit(reqs, count);
+    for (usize i = 0; i < count; i++) {
+        device->wait(reqs[i]);
+    }
+}
+
 // read log header from disk.
 static INLINE void read_header() {
     device->read(sblock->log_start, (u8 *)&header);
@@ -47,7 +188,39 @@ static INLINE void write_header() {
     device->write(sblock->log_start, (u8 *)&header);
 }
 
-static void replay();
+// return the shard that `block_no` belongs to.
+static INLINE CacheShard *get_shard(usize block_no) {
+    return &shards[block_no % BCACHE_NUM_SHARDS];
+}
+
+// return the hash bucket of `block_no` inside its shard.
+static INLINE ListNode *get_bucket(CacheShard *shard, usize block_no) {
+    return &shard->buckets[(block_no / BCACHE_NUM_SHARDS) % BCACHE_NUM_BUCKETS];
+}
+
+static void replay(bool unpin_blocks);
+static bool should_commit();
+static void write_group_desc(Block *block);
+static u32 log_checksum();
+static void group_commit();
+static void load_group_desc();
+static void commit_freed_blocks();
+static void release_freed_blocks();
+static const ReplacementPolicy *get_policy(BlockCachePolicy which);
+
+// reset all shards to be empty, with new capacity and replacement policy.
+//
+// NOTE: the caller must hold the locks of all shards.
+static void reset_shards(usize capacity, BlockCachePolicy which) {
+    policy = get_policy(which);
+    for (usize i = 0; i < BCACHE_NUM_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        shard->num_blocks = 0;
+        shard->capacity = MAX(capacity / BCACHE_NUM_SHARDS, (usize)1);
+        policy->init(shard);
+    }
+    __atomic_store_n(&num_cached, 0, __ATOMIC_RELEASE);
+}
 
 // initialize block cache.
 void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
@@ -57,96 +230,426 @@ void init_bcache(const SuperBlock *_sblock, const BlockDevice *_device) {
     ArenaPageAllocator allocator = {.allocate = kalloc, .free = kfree};
     init_spinlock(&lock, "block cache");
     init_arena(&arena, sizeof(Block), allocator);
-    init_list_node(&head);
+    init_arena(&ghost_arena, sizeof(Ghost), allocator);
+    init_arena(&freed_arena, sizeof(FreedBlocks), allocator);
+
+    for (usize i = 0; i < BCACHE_NUM_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        init_spinlock(&shard->lock, "block cache shard");
+        for (usize j = 0; j < BCACHE_NUM_BUCKETS; j++) {
+            init_list_node(&shard->buckets[j]);
+        }
+    }
+    reset_shards(BCACHE_CAPACITY, BCACHE_POLICY);
 
     last_allocated_ts = 0;
     last_persisted_ts = 0;
 
     log_start = sblock->log_start + 1;
-    log_size = MIN(sblock->num_log_blocks - 1, LOG_MAX_SIZE);
+    // 日志中为块组描述符表保留一项，它在组提交时才加入日志，
+    // 因此原子操作可用的日志项比日志区少一项
+    log_capacity = MIN(sblock->num_log_blocks - 1, LOG_MAX_SIZE) - 1;
+    log_size = log_capacity;
     log_used = 0;
 
     op_count = 0;
 
+    // 块组内数据块之前的块都已预先分配，分配游标直接从数据块起始处开始
+    for (usize i = 0; i < NGROUPS; i++) {
+        AllocGroup *group = &groups[i];
+        init_spinlock(&group->lock, "block group");
+        group->rotor = sblock->data_start_per_group;
+        group->largest_free = sblock->blocks_per_group;
+        group->num_frees = 0;
+        group->dirty = false;
+        init_list_node(&group->freed);
+    }
+
+    pending.num_blocks = 0;
+    checkpointing = false;
+    flush_requested = false;
+    num_waiting = 0;
+    last_commit_time = get_time_ms();
+
     read_header();
-    replay();
+
+    // a torn commit record is discarded, as if the group was never committed.
+    if (header.num_blocks > 0 &&
+        (header.num_blocks > log_capacity + 1 || header.checksum != log_checksum())) {
+        header.num_blocks = 0;
+        write_header();
+    }
+
+    replay(false);
+    load_group_desc();
 }
 
 // initialize a block struct.
 static void init_block(Block *block) {
     block->block_no = 0;
     init_list_node(&block->node);
-    block->acquired = false;
-    block->pinned = false;
+    init_list_node(&block->chain);
+    block->refcnt = 0;
+    block->pinned = 0;
+    block->state = 0;
+    block->prefetched = false;
 
     init_sleeplock(&block->lock, "block");
     block->valid = false;
     memset(block->data, 0, sizeof(block->data));
 }
 
-static usize _get_num_cached_blocks() {
-    usize count = 0;
-    for (ListNode *x = head.next; x != &head; x = x->next) {
-        count++;
+// a block can be evicted if nobody uses it and it is not pinned.
+static INLINE bool is_evictable(Block *block) {
+    return block->refcnt == 0 && !block->pinned;
+}
+
+// return the first evictable block on `list`, from LRU to MRU.
+static Block *first_evictable(ListNode *list) {
+    for (ListNode *cur = list->next; cur != list; cur = cur->next) {
+        Block *block = container_of(cur, Block, node);
+        if (is_evictable(block))
+            return block;
+    }
+    return NULL;
+}
+
+// CLOCK policy: a block gets a second chance if it is referenced since the
+// hand passed it last time.
+
+static void clock_init(CacheShard *shard) {
+    init_list_node(&shard->ring);
+    shard->hand = &shard->ring;
+}
+
+static void clock_clear(CacheShard *shard) {
+    (void)shard;
+}
+
+static void clock_hit(CacheShard *shard, Block *block) {
+    (void)shard;
+    block->state = 1;
+}
+
+static Block *clock_evict(CacheShard *shard, usize block_no) {
+    (void)block_no;
+    if (shard->num_blocks < shard->capacity)
+        return NULL;
+
+    // at most two rounds, since the first round may only clear reference bits.
+    for (usize i = 0; i < 2 * (shard->num_blocks + 1); i++) {
+        ListNode *cur = shard->hand;
+        shard->hand = cur->next;
+        if (cur == &shard->ring)
+            continue;
+
+        Block *block = container_of(cur, Block, node);
+        if (!is_evictable(block))
+            continue;
+        if (block->state) {
+            block->state = 0;
+            continue;
+        }
+
+        detach_from_list(cur);
+        return block;
+    }
+
+    return NULL;
+}
+
+static void clock_insert(CacheShard *shard, Block *block) {
+    // put it right behind the hand, so it will be checked last.
+    block->state = 0;
+    merge_list(shard->hand->prev, &block->node);
+}
+
+static const ReplacementPolicy clock_policy = {
+    .init = clock_init,
+    .clear = clock_clear,
+    .hit = clock_hit,
+    .evict = clock_evict,
+    .insert = clock_insert,
+};
+
+// ARC policy: see "ARC: A Self-Tuning, Low Overhead Replacement Cache" by
+// Megiddo and Modha. Blocks seen once live in T1 and blocks seen at least
+// twice live in T2. B1/B2 remember blocks recently evicted from T1/T2, and
+// hits on them adapt the target size of T1.
+// `block->state` tells which list a block is on: 0 for T1 and 1 for T2.
+
+static INLINE ListNode *get_ghost_bucket(CacheShard *shard, usize block_no) {
+    return &shard->ghosts[(block_no / BCACHE_NUM_SHARDS) % BCACHE_NUM_BUCKETS];
+}
+
+static Ghost *arc_find_ghost(CacheShard *shard, usize block_no) {
+    ListNode *bucket = get_ghost_bucket(shard, block_no);
+    for (ListNode *cur = bucket->next; cur != bucket; cur = cur->next) {
+        Ghost *ghost = container_of(cur, Ghost, chain);
+        if (ghost->block_no == block_no)
+            return ghost;
+    }
+    return NULL;
+}
+
+// append a ghost of `block_no` to the MRU end of B1 (`list == 0`) or B2.
+static void arc_remember(CacheShard *shard, u8 list, usize block_no) {
+    Ghost *ghost = alloc_object(&ghost_arena);
+    assert(ghost != NULL);
+    ghost->block_no = block_no;
+    ghost->list = list;
+    init_list_node(&ghost->node);
+    init_list_node(&ghost->chain);
+    merge_list(shard->b[list].prev, &ghost->node);
+    merge_list(get_ghost_bucket(shard, block_no), &ghost->chain);
+    shard->num_b[list]++;
+}
+
+static void arc_forget(CacheShard *shard, Ghost *ghost) {
+    detach_from_list(&ghost->node);
+    detach_from_list(&ghost->chain);
+    shard->num_b[ghost->list]--;
+    free_object(ghost);
+}
+
+// forget the LRU ghost of B1 (`list == 0`) or B2.
+static void arc_forget_lru(CacheShard *shard, u8 list) {
+    if (shard->num_b[list] > 0)
+        arc_forget(shard, container_of(shard->b[list].next, Ghost, node));
+}
+
+// take an evictable block out of T1 or T2, i.e. `REPLACE` in the ARC paper.
+static Block *arc_replace(CacheShard *shard, bool in_b2) {
+    usize t1 = shard->num_t[0];
+    u8 list = t1 > 0 && (t1 > shard->target || (in_b2 && t1 == shard->target)) ? 0 : 1;
+
+    // acquired or pinned blocks cannot be evicted, so fall back to the other list.
+    Block *block = first_evictable(&shard->t[list]);
+    if (!block) {
+        list = (u8)(1 - list);
+        block = first_evictable(&shard->t[list]);
+    }
+    if (!block)
+        return NULL;
+
+    detach_from_list(&block->node);
+    shard->num_t[list]--;
+    arc_remember(shard, list, block->block_no);
+    return block;
+}
+
+static void arc_init(CacheShard *shard) {
+    for (usize i = 0; i < 2; i++) {
+        init_list_node(&shard->t[i]);
+        init_list_node(&shard->b[i]);
+        shard->num_t[i] = 0;
+        shard->num_b[i] = 0;
+    }
+    shard->target = 0;
+    for (usize i = 0; i < BCACHE_NUM_BUCKETS; i++) {
+        init_list_node(&shard->ghosts[i]);
+    }
+}
+
+static void arc_clear(CacheShard *shard) {
+    for (u8 i = 0; i < 2; i++) {
+        while (shard->num_b[i] > 0) {
+            arc_forget_lru(shard, i);
+        }
+    }
+}
+
+static void arc_hit(CacheShard *shard, Block *block) {
+    // move it to the MRU end of T2.
+    detach_from_list(&block->node);
+    shard->num_t[block->state]--;
+    block->state = 1;
+    merge_list(shard->t[1].prev, &block->node);
+    shard->num_t[1]++;
+}
+
+static Block *arc_evict(CacheShard *shard, usize block_no) {
+    usize c = shard->capacity;
+    bool full = shard->num_blocks >= c;
+
+    // a hit in B1 favors recency and a hit in B2 favors frequency.
+    Ghost *ghost = arc_find_ghost(shard, block_no);
+    if (ghost) {
+        usize b1 = shard->num_b[0], b2 = shard->num_b[1];
+        if (ghost->list == 0)
+            shard->target = MIN(c, shard->target + MAX(b2 / b1, (usize)1));
+        else
+            shard->target -= MIN(shard->target, MAX(b1 / b2, (usize)1));
+        return full ? arc_replace(shard, ghost->list == 1) : NULL;
+    }
+
+    usize l1 = shard->num_t[0] + shard->num_b[0];
+    usize total = l1 + shard->num_t[1] + shard->num_b[1];
+    if (l1 >= c) {
+        if (shard->num_t[0] < c) {
+            arc_forget_lru(shard, 0);
+            return full ? arc_replace(shard, false) : NULL;
+        }
+
+        // T1 alone fills the shard: drop its LRU block without a ghost.
+        Block *block = first_evictable(&shard->t[0]);
+        if (block) {
+            detach_from_list(&block->node);
+            shard->num_t[0]--;
+        }
+        return block;
+    }
+
+    if (total >= c) {
+        if (total >= 2 * c)
+            arc_forget_lru(shard, 1);
+        return full ? arc_replace(shard, false) : NULL;
+    }
+
+    return NULL;
+}
+
+static void arc_insert(CacheShard *shard, Block *block) {
+    // blocks remembered by ghosts are seen for at least the second time.
+    Ghost *ghost = arc_find_ghost(shard, block->block_no);
+    block->state = ghost ? 1 : 0;
+    if (ghost)
+        arc_forget(shard, ghost);
+
+    merge_list(shard->t[block->state].prev, &block->node);
+    shard->num_t[block->state]++;
+}
+
+static const ReplacementPolicy arc_policy = {
+    .init = arc_init,
+    .clear = arc_clear,
+    .hit = arc_hit,
+    .evict = arc_evict,
+    .insert = arc_insert,
+};
+
+static const ReplacementPolicy *get_policy(BlockCachePolicy which) {
+    switch (which) {
+        case BCACHE_POLICY_CLOCK: return &clock_policy;
+        case BCACHE_POLICY_ARC: return &arc_policy;
+        default: PANIC("unknown block cache policy %d", which);
     }
-    return count;
 }
 
 // see `cache.h`.
 static usize get_num_cached_blocks() {
-    acquire_spinlock(&lock);
-    usize count = _get_num_cached_blocks();
-    release_spinlock(&lock);
-    return count;
+    return __atomic_load_n(&num_cached, __ATOMIC_ACQUIRE);
 }
 
 // see `cache.h`.
-static Block *cache_acquire(usize block_no) {
-    acquire_spinlock(&lock);
+static void cache_configure(usize capacity, BlockCachePolicy which) {
+    for (usize i = 0; i < BCACHE_NUM_SHARDS; i++) {
+        acquire_spinlock(&shards[i].lock);
+    }
 
-    Block *slot = NULL;
-    for (ListNode *cur = head.next; cur != &head; cur = cur->next) {
-        Block *block = container_of(cur, Block, node);
-        if (block->block_no == block_no) {
-            slot = block;
-            break;
+    for (usize i = 0; i < BCACHE_NUM_SHARDS; i++) {
+        CacheShard *shard = &shards[i];
+        for (usize j = 0; j < BCACHE_NUM_BUCKETS; j++) {
+            ListNode *bucket = &shard->buckets[j];
+            while (bucket->next != bucket) {
+                Block *block = container_of(bucket->next, Block, chain);
+                assert(is_evictable(block));
+                detach_from_list(&block->chain);
+                free_object(block);
+            }
         }
+        policy->clear(shard);
+    }
+
+    reset_shards(capacity, which);
 
-        // find a candidate to be evicted.
-        if (!block->acquired && !block->pinned)
-            slot = block;
+    for (usize i = BCACHE_NUM_SHARDS; i > 0; i--) {
+        release_spinlock(&shards[i - 1].lock);
     }
+}
 
-    if (slot && slot->block_no != block_no) {
-        if (_get_num_cached_blocks() >= EVICTION_THRESHOLD) {
-            slot->block_no = block_no;
-            slot->valid = false;
-        } else {
-            // no need to evict. Just allocate a new one.
-            slot = NULL;
-        }
+// look up `block_no` in the hash table of `shard`.
+//
+// NOTE: the caller must hold the lock of `shard`.
+static Block *lookup(CacheShard *shard, usize block_no) {
+    ListNode *bucket = get_bucket(shard, block_no);
+    for (ListNode *cur = bucket->next; cur != bucket; cur = cur->next) {
+        Block *block = container_of(cur, Block, chain);
+        if (block->block_no == block_no)
+            return block;
     }
+    return NULL;
+}
+
+// pin an acquired block in block cache.
+static void pin(Block *block) {
+    CacheShard *shard = get_shard(block->block_no);
+    acquire_spinlock(&shard->lock);
+    block->pinned++;
+    release_spinlock(&shard->lock);
+}
+
+// drop a pin of `block_no`. Pinned blocks are always cached.
+static void unpin(usize block_no) {
+    CacheShard *shard = get_shard(block_no);
+    acquire_spinlock(&shard->lock);
+    Block *block = lookup(shard, block_no);
+    assert(block != NULL && block->pinned > 0);
+    block->pinned--;
+    release_spinlock(&shard->lock);
+}
 
-    // when not found and no block is going to be evicted.
-    if (!slot) {
+// take a block for `block_no`, which is not in `shard`, and put it into the
+// hash table and the replacement policy. Its content is not loaded.
+//
+// NOTE: the caller must hold the lock of `shard`.
+static Block *take_slot(CacheShard *shard, usize block_no) {
+    Block *slot = policy->evict(shard, block_no);
+
+    if (slot)
+        detach_from_list(&slot->chain);
+    else {
+        // when no block is going to be evicted, just allocate a new one.
         slot = alloc_object(&arena);
         assert(slot != NULL);
         init_block(slot);
-        slot->block_no = block_no;
+        shard->num_blocks++;
+        __atomic_fetch_add(&num_cached, 1, __ATOMIC_ACQ_REL);
     }
 
-    // move to the front.
-    detach_from_list(&slot->node);
-    merge_list(&head, &slot->node);
-
-    // NOTE: set `acquired` before releasing cache lock to prevent someone evicting
-    // this block in the window between `release` and `acquire`.
-    slot->acquired = true;
+    slot->block_no = block_no;
+    slot->valid = false;
+    slot->prefetched = false;
+    merge_list(get_bucket(shard, block_no), &slot->chain);
+    policy->insert(shard, slot);
+    return slot;
+}
 
-    release_spinlock(&lock);
+// see `cache.h`.
+// look up or take a slot for `block_no`, and lock it. If `fill` is true, the
+// content is loaded from disk if it is not valid. Otherwise the caller is
+// going to overwrite the whole block and should mark it valid.
+static Block *acquire_block(usize block_no, bool fill) {
+    CacheShard *shard = get_shard(block_no);
+    acquire_spinlock(&shard->lock);
+
+    Block *slot = lookup(shard, block_no);
+
+    if (!slot)
+        slot = take_slot(shard, block_no);
+    else if (slot->prefetched)
+        slot->prefetched = false;  // the first real access.
+    else
+        policy->hit(shard, slot);
+
+    // NOTE: increase `refcnt` before releasing shard lock to prevent someone
+    // evicting this block in the window between `release` and `acquire`.
+    slot->refcnt++;
+
+    release_spinlock(&shard->lock);
     acquire_sleeplock(&slot->lock);
 
-    if (!slot->valid) {
+    if (fill && !slot->valid) {
         device_read(slot);
         slot->valid = true;
     }
@@ -154,28 +657,88 @@ static Block *cache_acquire(usize block_no) {
     return slot;
 }
 
+// see `cache.h`.
+static Block *cache_acquire(usize block_no) {
+    return acquire_block(block_no, true);
+}
+
+// see `cache.h`.
+static Block *cache_acquire_zeroed(usize block_no) {
+    Block *block = acquire_block(block_no, false);
+    memset(block->data, 0, BLOCK_SIZE);
+    block->valid = true;
+    return block;
+}
+
 // see `cache.h`.
 static void cache_release(Block *block) {
     release_sleeplock(&block->lock);
-    acquire_spinlock(&lock);
-    block->acquired = false;
-    release_spinlock(&lock);
+
+    CacheShard *shard = get_shard(block->block_no);
+    acquire_spinlock(&shard->lock);
+    block->refcnt--;
+    release_spinlock(&shard->lock);
 }
 
 // see `cache.h`.
-static void cache_begin_op(OpContext *ctx) {
+static void cache_prefetch(const usize *block_nos, usize count) {
+    Block *slots[IO_BATCH_SIZE];
+
+    for (usize i = 0; i < count;) {
+        usize n = 0;
+        for (; i < count && n < IO_BATCH_SIZE; i++) {
+            CacheShard *shard = get_shard(block_nos[i]);
+            acquire_spinlock(&shard->lock);
+
+            if (lookup(shard, block_nos[i])) {
+                release_spinlock(&shard->lock);
+                continue;
+            }
+
+            Block *slot = take_slot(shard, block_nos[i]);
+            slot->prefetched = true;
+            slot->refcnt++;
+
+            // nobody holds the lock of a block just taken, so this never sleeps.
+            // Locking it here keeps others from waiting on it while we hold others.
+            acquire_sleeplock(&slot->lock);
+            release_spinlock(&shard->lock);
+            slots[n++] = slot;
+        }
+
+        device_rw(slots, NULL, n, false);
+
+        for (usize j = 0; j < n; j++) {
+            slots[j]->valid = true;
+            cache_release(slots[j]);
+        }
+    }
+}
+
+// see `cache.h`.
+static void cache_begin_op(OpContext *ctx, usize num_blocks) {
+    assert(num_blocks <= log_capacity);
+
     init_spinlock(&ctx->lock, "atomic operation context");
     ctx->ts = 0;
+    ctx->num_reserved = num_blocks;
     ctx->num_blocks = 0;
-    memset(ctx->block_no, 0, sizeof(ctx->block_no));
 
     acquire_spinlock(&lock);
 
-    while (log_used + OP_MAX_NUM_BLOCKS > log_size) {
-        sleep(&log_used, &lock);
+    // a pending `flush` holds back new atomic operations, so that it will not
+    // starve.
+    while (flush_requested || log_used + num_blocks > log_size) {
+        // nobody else may end an atomic operation to make room in log.
+        num_waiting++;
+        if (should_commit())
+            group_commit();
+        else
+            sleep(&log_used, &lock);
+        num_waiting--;
     }
 
-    log_used += OP_MAX_NUM_BLOCKS;
+    log_used += num_blocks;
     ctx->ts = ++last_allocated_ts;
     op_count++;
 
@@ -193,20 +756,57 @@ static void cache_sync(OpContext *ctx, Block *block) {
                 break;
         }
 
-        assert(i < OP_MAX_NUM_BLOCKS);
-        ctx->block_no[i] = block->block_no;
-        if (i >= ctx->num_blocks)
+        assert(i < ctx->num_reserved);
+        ctx->block_no[i] = (u32)block->block_no;
+        bool added = i >= ctx->num_blocks;
+        if (added)
             ctx->num_blocks++;
 
         release_spinlock(&ctx->lock);
-        acquire_spinlock(&lock);
-        block->pinned = true;
-        release_spinlock(&lock);
+
+        // every log entry of `ctx` holds a pin.
+        if (added)
+            pin(block);
     } else
         device_write(block);
 }
 
-// commit all block number records associated with `ctx` into log header.
+// see `cache.h`.
+static void cache_sync_data(OpContext *ctx, Block *block) {
+    if (ctx) {
+        // a fresh block is zero-filled and logged by `alloc` in this atomic
+        // operation. That log entry is superseded by the write below.
+        acquire_spinlock(&ctx->lock);
+
+        usize i = 0;
+        for (; i < ctx->num_blocks; i++) {
+            if (ctx->block_no[i] == block->block_no)
+                break;
+        }
+
+        bool owned = i < ctx->num_blocks;
+        CacheShard *shard = get_shard(block->block_no);
+        acquire_spinlock(&shard->lock);
+        bool logged = block->pinned > (owned ? 1u : 0u);
+        release_spinlock(&shard->lock);
+
+        if (owned && !logged) {
+            ctx->block_no[i] = ctx->block_no[--ctx->num_blocks];
+            unpin(block->block_no);
+        }
+
+        release_spinlock(&ctx->lock);
+
+        if (logged) {
+            cache_sync(ctx, block);
+            return;
+        }
+    }
+
+    device_write(block);
+}
+
+// commit all block number records associated with `ctx` into `pending`.
 //
 // NOTE: the caller must hold the lock of block cache.
 static void commit(OpContext *ctx) {
@@ -216,46 +816,79 @@ static void commit(OpContext *ctx) {
     for (usize i = 0; i < ctx->num_blocks; i++) {
         usize block_no = ctx->block_no[i];
         usize j = 0;
-        for (; j < header.num_blocks; j++) {
-            if (header.block_no[j] == block_no)
+        for (; j < pending.num_blocks; j++) {
+            if (pending.block_no[j] == block_no)
                 break;
         }
 
         assert(j < log_size);
-        header.block_no[j] = block_no;
-        if (j < header.num_blocks)
+        pending.block_no[j] = (u32)block_no;
+        if (j < pending.num_blocks) {
+            // the existing entry already holds a pin.
             absorbed++;
-        else
-            header.num_blocks++;
+            unpin(block_no);
+        } else
+            pending.num_blocks++;
     }
 
     release_spinlock(&ctx->lock);
 
     // blocks reserved but not used are now returned back.
-    usize unused = OP_MAX_NUM_BLOCKS - ctx->num_blocks;
+    usize unused = ctx->num_reserved - ctx->num_blocks;
 
     // the lock is holded by the caller.
     log_used -= unused + absorbed;
     wakeup(&log_used);
 }
 
+// sort indices of log entries by their block numbers into `order`.
+static void sort_log_entries(usize *order) {
+    // insertion sort, since there are only a few entries and they are often
+    // nearly sorted.
+    for (usize i = 0; i < header.num_blocks; i++) {
+        usize j = i;
+        for (; j > 0 && header.block_no[order[j - 1]] > header.block_no[i]; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+}
+
 // replay logs if there's any.
-static void replay() {
+// if `unpin_blocks` is true, pins held by log entries are dropped.
+static void replay(bool unpin_blocks) {
     if (header.num_blocks == 0)
         return;
 
     // step 3: copy blocks from log to their original locations on disk.
-    // don't forget to un-pin them in block cache.
-    for (usize i = 0; i < header.num_blocks; i++) {
-        Block *src = cache_acquire(log_start + i);
-        Block *dest = cache_acquire(header.block_no[i]);
-        memcpy(dest->data, src->data, BLOCK_SIZE);
-        cache_release(src);
-        device_write(dest);
-        acquire_spinlock(&lock);
-        dest->pinned = false;
-        release_spinlock(&lock);
-        cache_release(dest);
+    // blocks are written from the log blocks, which hold the content at the
+    // time of group commit. Cached blocks may be newer, and they are not
+    // touched.
+    // blocks are written in the order of their locations, so that the device
+    // can merge adjacent ones into multi-block writes.
+    usize order[LOG_MAX_SIZE];
+    sort_log_entries(order);
+
+    Block *src[IO_BATCH_SIZE];
+    usize block_nos[IO_BATCH_SIZE];
+    for (usize i = 0; i < header.num_blocks; i += IO_BATCH_SIZE) {
+        usize n = MIN(header.num_blocks - i, (usize)IO_BATCH_SIZE);
+        for (usize j = 0; j < n; j++) {
+            src[j] = cache_acquire(log_start + order[i + j]);
+            block_nos[j] = header.block_no[order[i + j]];
+        }
+
+        device_rw(src, block_nos, n, true);
+
+        for (usize j = 0; j < n; j++) {
+            // pinned blocks are not evicted, so no stale content is read
+            // from disk before the writes above complete.
+            if (unpin_blocks) {
+                unpin(block_nos[j]);
+                unpin(src[j]->block_no);
+            }
+            cache_release(src[j]);
+        }
     }
 
     // step 4: now that all blocks are written back, just clear log.
@@ -263,33 +896,176 @@ static void replay() {
     write_header();
 }
 
-// persist all blocks recorded in log header to disk.
+// copy the content of blocks in `header` into log blocks. Log blocks are
+// pinned until `replay`.
 //
-// NOTE: checkpointing is time consuming, so the caller should NOT hold the
-// lock of block cache.
-static void checkpoint() {
-    // step 1: write blocks into logging area first.
+// the group descriptor table is filled with the free block counts of block
+// groups first. If it is one of the last `num_appended` entries, which are
+// added by `log_group_desc`, it is pinned here like other log entries.
+static void snapshot(usize num_appended) {
     for (usize i = 0; i < header.num_blocks; i++) {
         Block *src = cache_acquire(header.block_no[i]);
-        Block *dest = cache_acquire(log_start + i);
+        if (src->block_no == sblock->gdt_start) {
+            write_group_desc(src);
+            if (i + num_appended >= header.num_blocks)
+                pin(src);
+        }
+        Block *dest = acquire_block(log_start + i, false);
         memcpy(dest->data, src->data, BLOCK_SIZE);
-        cache_release(src);
-        device_write(dest);
+        dest->valid = true;
+        pin(dest);
         cache_release(dest);
+        cache_release(src);
     }
+}
 
-    // step 2: write header block to mark all atomic operations are now
-    // persisted in log.
-    write_header();
+// compute the checksum of log header and logged blocks.
+//
+// NOTE: the caller must not hold the locks of log blocks.
+static u32 log_checksum() {
+    u32 sum = checksum(CHECKSUM_INIT, &header.num_blocks, sizeof(header.num_blocks));
+    sum = checksum(sum, header.block_no, sizeof(u32) * header.num_blocks);
+    for (usize i = 0; i < header.num_blocks; i++) {
+        Block *block = cache_acquire(log_start + i);
+        sum = checksum(sum, block->data, BLOCK_SIZE);
+        cache_release(block);
+    }
+    return sum;
+}
+
+// persist all blocks recorded in log header to disk.
+// their content should have been copied into log blocks by `snapshot`.
+//
+// NOTE: checkpointing is time consuming, so the caller should NOT hold the
+// lock of block cache.
+static void checkpoint() {
+    // only one thread checkpoints at a time.
+    static Block *dest[LOG_MAX_SIZE];
+    static BlockRequest *reqs[LOG_MAX_SIZE + 1];
+
+    if (header.num_blocks == 0)
+        return;
+
+    // step 1 & step 2: write blocks into logging area, and write header block
+    // to mark all atomic operations are now persisted in log.
+    // the checksum tells whether all of them reach disk, so they are written
+    // at the same time, rather than header after blocks.
+    header.checksum = log_checksum();
+
+    usize n = header.num_blocks;
+    for (usize i = 0; i < n; i++) {
+        dest[i] = cache_acquire(log_start + i);
+        reqs[i] = &dest[i]->req;
+        init_request(reqs[i], log_start + i, dest[i]->data, true);
+    }
+    reqs[n] = &header_req;
+    init_request(reqs[n], sblock->log_start, (u8 *)&header, true);
+
+    device->submit(reqs, n + 1);
+    for (usize i = 0; i <= n; i++) {
+        device->wait(reqs[i]);
+    }
+
+    for (usize i = 0; i < n; i++) {
+        cache_release(dest[i]);
+    }
 
     // step 3 & step 4 in `replay`.
-    replay();
+    replay(true);
+}
+
+// 组提交时，若有块组的空闲块数在上次组提交之后被修改，将描述符表块追加到
+// `header`末尾。所有原子操作都已结束，此时内存中的空闲块数与位图一致
+// 返回追加的日志项数，描述符表块已经在日志中时不重复追加
+//
+// NOTE: the caller must hold the lock of block cache.
+static usize log_group_desc() {
+    bool dirty = false;
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        AllocGroup *group = &groups[i];
+        acquire_spinlock(&group->lock);
+        dirty = dirty || group->dirty;
+        group->dirty = false;
+        release_spinlock(&group->lock);
+    }
+    if (!dirty)
+        return 0;
+
+    for (usize i = 0; i < header.num_blocks; i++) {
+        if (header.block_no[i] == sblock->gdt_start)
+            return 0;
+    }
+    header.block_no[header.num_blocks++] = (u32)sblock->gdt_start;
+    return 1;
+}
+
+// should committed atomic operations be checkpointed now?
+//
+// NOTE: the caller must hold the lock of block cache.
+static bool should_commit() {
+    // a group commit can only start when all atomic operations are committed,
+    // and the last group is checkpointed.
+    if (checkpointing || op_count > 0)
+        return false;
+
+    if (flush_requested || num_waiting > 0 || log_used + OP_MAX_NUM_BLOCKS > log_size)
+        return true;
+    return pending.num_blocks > 0 &&
+           get_time_ms() - last_commit_time >= BCACHE_COMMIT_INTERVAL;
+}
+
+// checkpoint committed atomic operations as a group, until there is no need
+// to commit.
+//
+// new atomic operations are blocked only when the content of the group is
+// copied into log blocks. They can reserve log space and commit while the
+// group is being written to disk, and they will be checkpointed as the next
+// group.
+//
+// NOTE: the caller must hold the lock of block cache, and `should_commit`
+// must be true. The lock is released during checkpointing.
+static void group_commit() {
+    do {
+        usize ts = last_allocated_ts;
+        checkpointing = true;
+        flush_requested = false;
+
+        // all atomic operations are committed, so `pending` is the whole group.
+        header.num_blocks = pending.num_blocks;
+        memcpy(header.block_no, pending.block_no, sizeof(u32) * pending.num_blocks);
+        pending.num_blocks = 0;
+        usize num_appended = log_group_desc();
+        commit_freed_blocks();
+
+        // block all `begin_op` while taking a snapshot.
+        log_size = 0;
+        release_spinlock(&lock);
+
+        snapshot(num_appended);
+
+        acquire_spinlock(&lock);
+        log_size = log_capacity;
+        log_used = 0;
+        wakeup(&log_used);
+        release_spinlock(&lock);
+
+        checkpoint();
+        release_freed_blocks();
 
-    // step 5: wake up all sleeping threads waiting in `end_op`.
+        acquire_spinlock(&lock);
+        checkpointing = false;
+        last_persisted_ts = ts;
+        last_commit_time = get_time_ms();
+        wakeup(&last_persisted_ts);
+    } while (should_commit());
+}
+
+// see `cache.h`.
+static usize cache_get_free_log_space() {
     acquire_spinlock(&lock);
-    last_persisted_ts = last_allocated_ts;
+    usize space = flush_requested || log_used > log_size ? 0 : log_size - log_used;
     release_spinlock(&lock);
-    wakeup(&last_persisted_ts);
+    return space;
 }
 
 // see `cache.h`.
@@ -299,37 +1075,36 @@ static void cache_end_op(OpContext *ctx) {
     commit(ctx);
     op_count--;
 
-    // this will make sure only one thread gets `do_checkpoint == true`.
-    bool do_checkpoint = op_count == 0;
-    usize log_size_copy = log_size;
-
-    if (do_checkpoint) {
-        // this will block all `begin_op`.
-        log_size = 0;
-    } else {
-        while (ctx->ts > last_persisted_ts) {
-            sleep(&last_persisted_ts, &lock);
-        }
-    }
+    if (should_commit())
+        group_commit();
 
     release_spinlock(&lock);
+}
 
-    if (do_checkpoint) {
-        // at this time:
-        // 1. all atomic operations, except this one, are waiting in `end_op`.
-        //    idealy, no one will invoke `cache_sync`.
-        // 2. all `begin_op` will be blocked because `log_size` is zero.
-        // 3. some read-only operations can continue to acquire the lock of
-        //    block cache.
+// see `cache.h`.
+static void cache_flush() {
+    acquire_spinlock(&lock);
 
-        checkpoint();
+    // if a group is being checkpointed, the next group commit will be done
+    // right after it.
+    usize ts = last_allocated_ts;
+    flush_requested = true;
+    if (should_commit())
+        group_commit();
 
-        acquire_spinlock(&lock);
-        log_size = log_size_copy;
-        log_used = 0;
-        release_spinlock(&lock);
-        wakeup(&log_used);
+    while (ts > last_persisted_ts) {
+        sleep(&last_persisted_ts, &lock);
     }
+
+    release_spinlock(&lock);
+}
+
+// see `cache.h`.
+static void cache_commit_if_due() {
+    acquire_spinlock(&lock);
+    if (should_commit())
+        group_commit();
+    release_spinlock(&lock);
 }
 
 // static usize cache_alloc(OpContext *ctx) {
@@ -360,83 +1135,331 @@ static void cache_end_op(OpContext *ctx) {
 // }
 
 
+// see `cache.h`.
+// hint: you can use `cache_acquire`/`cache_sync` to read/write blocks.
+
+// 挂载时直接从磁盘一次读入块组描述符表，恢复各块组的已使用数据块数
+// 描述符表在日志恢复之后读取，因此总是与位图一致
+static void load_group_desc() {
+    static u8 data[BLOCK_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    assert(sblock->num_groups <= GROUP_DESC_PER_BLOCK);
+    device->read(sblock->gdt_start, data);
+    GroupDesc *desc = (GroupDesc *)data;
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        groups[i].num_free_blocks = desc[i].num_free_blocks;
+        used_block[i] = sblock->num_datablocks_per_group - desc[i].num_free_blocks;
+    }
+}
+
+// 将各块组内存中的空闲块数写入描述符表块`block`，在组提交时调用
+// 描述符中的其他字段由inode层在原子操作中修改，这里保持不变
+static void write_group_desc(Block *block) {
+    GroupDesc *desc = (GroupDesc *)block->data;
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        AllocGroup *group = &groups[i];
+        acquire_spinlock(&group->lock);
+        desc[i].num_free_blocks = group->num_free_blocks;
+        release_spinlock(&group->lock);
+    }
+}
+
+// 修改块组`gno`内存中的空闲块数，并同步已使用块数
+// 只持有块组自己的锁，不同块组中的分配互不影响。描述符表在组提交时写入
+static void adjust_free_blocks(usize gno, isize delta) {
+    AllocGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    group->num_free_blocks = (u32)((isize)group->num_free_blocks + delta);
+    group->dirty = true;
+    used_block[gno] = sblock->num_datablocks_per_group - group->num_free_blocks;
+    release_spinlock(&group->lock);
+}
+
+// 返回块组`gno`的分配游标
+static usize get_rotor(usize gno) {
+    AllocGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    usize rotor = group->rotor;
+    release_spinlock(&group->lock);
+    return rotor;
+}
+
+// 在块组`gno`中分配了组内偏移`[offset, offset + n)`后，将分配游标移到其后
+static void advance_rotor(usize gno, usize offset, usize n) {
+    AllocGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    group->rotor = (u32)((offset + n) % sblock->blocks_per_group);
+    release_spinlock(&group->lock);
+}
+
+// 块组`gno`中的数据块是否已全部分配
+static bool group_full(usize gno) {
+    AllocGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    bool full = used_block[gno] >= sblock->num_datablocks_per_group;
+    release_spinlock(&group->lock);
+    return full;
+}
+
+// 返回块组`group`中第`index`个位图块的`FreedBlocks`，没有时返回NULL
+//
+// NOTE: the caller must hold the lock of `group`.
+static FreedBlocks *find_freed(AllocGroup *group, usize index) {
+    for (ListNode *cur = group->freed.next; cur != &group->freed; cur = cur->next) {
+        FreedBlocks *freed = container_of(cur, FreedBlocks, node);
+        if (freed->index == index)
+            return freed;
+    }
+    return NULL;
+}
+
+// 位图块内偏移`j`处的块是否已释放但尚不可分配
+static INLINE bool is_freed(FreedBlocks *freed, usize j) {
+    return bitmap_get(freed->freeing, j) || bitmap_get(freed->committing, j);
+}
+
+// 在位图块中查找`[begin, size)`内第一个可分配的块，即位图中为0且不在`freed`中的块
+// 找不到时返回`size`。`freed`可以为NULL
+static usize find_next_free(BitmapCell *bitmap, FreedBlocks *freed, usize size, usize begin) {
+    usize j = bitmap_find_next_zero(bitmap, size, begin);
+    while (freed != NULL && j < size && is_freed(freed, j)) {
+        j = bitmap_find_next_zero(bitmap, size, j + 1);
+    }
+    return j;
+}
+
+// 在位图块中查找`[begin, size)`内第一个不可分配的块，找不到时返回`size`
+static usize find_next_busy(BitmapCell *bitmap, FreedBlocks *freed, usize size, usize begin) {
+    usize k = bitmap_find_next_set(bitmap, size, begin);
+    if (freed != NULL) {
+        k = bitmap_find_next_set(freed->freeing, k, begin);
+        k = bitmap_find_next_set(freed->committing, k, begin);
+    }
+    return k;
+}
+
+// 组提交时，此前释放的块随这一组一起检查点
+//
+// NOTE: all atomic operations have ended, and the last group is checkpointed.
+static void commit_freed_blocks() {
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        AllocGroup *group = &groups[i];
+        acquire_spinlock(&group->lock);
+        for (ListNode *cur = group->freed.next; cur != &group->freed; cur = cur->next) {
+            FreedBlocks *freed = container_of(cur, FreedBlocks, node);
+            for (usize j = 0; j < BITMAP_TO_NUM_CELLS(BIT_PER_BLOCK); j++) {
+                freed->committing[j] |= freed->freeing[j];
+            }
+            bitmap_clear_range(freed->freeing, 0, BIT_PER_BLOCK);
+        }
+        release_spinlock(&group->lock);
+    }
+}
+
+// 检查点之后，其中释放的块才可以重新分配
+static void release_freed_blocks() {
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        AllocGroup *group = &groups[i];
+        acquire_spinlock(&group->lock);
+
+        bool released = false;
+        ListNode *cur = group->freed.next;
+        while (cur != &group->freed) {
+            FreedBlocks *freed = container_of(cur, FreedBlocks, node);
+            cur = cur->next;
+
+            released = released || bitmap_count(freed->committing, 0, BIT_PER_BLOCK) > 0;
+            bitmap_clear_range(freed->committing, 0, BIT_PER_BLOCK);
+            if (bitmap_count(freed->freeing, 0, BIT_PER_BLOCK) == 0) {
+                detach_from_list(&freed->node);
+                free_object(freed);
+            }
+        }
+
+        // 可分配的空闲区间变长了，`largest_free`不再是上界
+        if (released) {
+            group->largest_free = sblock->blocks_per_group;
+            group->num_frees++;
+        }
+        release_spinlock(&group->lock);
+    }
+}
+
+// 在块组`gno`的组内偏移区间`[begin, end)`中查找第一个空闲块并分配
+// 成功时返回块编号，并将该块组的分配游标移到新分配块之后；失败返回0
+static usize alloc_range(OpContext *ctx, usize gno, usize begin, usize end) {
+    usize group_start = sblock->bg_start + gno * sblock->blocks_per_group;
+    while (begin < end) {
+        // 任一块组位图块编号 = 块组起始 + 块组内位图起始 + 位图块偏移
+        usize i = begin / BIT_PER_BLOCK * BIT_PER_BLOCK;
+        Block *block = cache_acquire(group_start + sblock->bitmap_start_per_group + i / BIT_PER_BLOCK);
+
+        // 读取位图块信息后转化为BitmapCell数据结构，按字查找空闲位
+        // 跳过已释放但尚未检查点的块
+        BitmapCell *bitmap = (BitmapCell *)block->data;
+        usize size = MIN((usize)BIT_PER_BLOCK, end - i);
+        AllocGroup *group = &groups[gno];
+        acquire_spinlock(&group->lock);
+        FreedBlocks *freed = find_freed(group, i / BIT_PER_BLOCK);
+        usize j = find_next_free(bitmap, freed, size, begin - i);
+        release_spinlock(&group->lock);
+        if (j < size) {
+            bitmap_set(bitmap, j);
+            cache_sync(ctx, block);
+            cache_release(block);
+
+            usize block_no = group_start + i + j;
+            block = cache_acquire_zeroed(block_no);
+            cache_sync(ctx, block);
+            cache_release(block);
+
+            // 一旦新分配了一个数据块，更新块组描述符和分配游标
+            adjust_free_blocks(gno, -1);
+            advance_rotor(gno, i + j, 1);
+
+            return block_no;
+        }
+
+        cache_release(block);
+        begin = i + BIT_PER_BLOCK;
+    }
+    return 0;
+}
+
+// 在块组`gno`内从组内偏移`start`开始查找空闲块，到达块组尾后回绕到块组头
+static usize alloc_from(OpContext *ctx, usize gno, usize start) {
+    usize block_no = alloc_range(ctx, gno, start, sblock->blocks_per_group);
+    if (block_no == 0)
+        block_no = alloc_range(ctx, gno, 0, start);
+    return block_no;
+}
+
 // see `cache.h`.
 // hint: you can use `cache_acquire`/`cache_sync` to read/write blocks.
 
 // 修改：适应FFS文件结构
 // cache_alloc映射到alloc函数
-// 功能为从前往后遍历，找到第一个空闲的数据块并返回块编号
+// 功能为按块组顺序遍历，在每个块组内从分配游标处开始查找空闲的数据块并返回块编号
 static usize cache_alloc(OpContext *ctx) {
     // 修改后的alloc函数新增了块组编号这一层循环
     for (usize h = 0 ; h < sblock->num_groups; h++) {
-        for (usize i = 0; i < sblock->blocks_per_group; i += BIT_PER_BLOCK) {
-            // 由于新增了块组编号，块编号的计算方式也需要更新
-            // 任一块组位图块编号 = 块组起始 + 块组偏移块数 + 块组内位图起始 + 位图块偏移
-            usize block_no = sblock->bg_start + 
-                            h * sblock->blocks_per_group +
-                            sblock->bitmap_start_per_group + 
-                            i / BIT_PER_BLOCK;
-            Block *block = cache_acquire(block_no);
-
-            // 读取位图块信息后转化为BitmapCell数据结构
-            // 便于后续处理
-            BitmapCell *bitmap = (BitmapCell *)block->data;
-            // 遍历位图的每一位
-            for (usize j = 0; j < BIT_PER_BLOCK && i + j < sblock->blocks_per_group; j++) {
-                // 由于是顺序分配，因此找到第一个空闲位图则返回相应的块编号
-                if (!bitmap_get(bitmap, j)) {
-                    bitmap_set(bitmap, j);
-                    cache_sync(ctx, block);
-                    cache_release(block);
-
-                    block_no = sblock->bg_start + h * sblock->blocks_per_group + i + j;
-                    block = cache_acquire(block_no);
-                    memset(block->data, 0, BLOCK_SIZE);
-                    cache_sync(ctx, block);
-                    cache_release(block);
-
-                    // 一旦新分配了一个数据块，更新块组的数据块使用信息
-                    used_block[h]++;
-
-                    return block_no;
-                }
-            }
-
-            cache_release(block);
-        }
+        if (group_full(h))
+            continue;
+        usize block_no = alloc_from(ctx, h, get_rotor(h));
+        if (block_no != 0)
+            return block_no;
     }
     PANIC("cache_alloc: no free block");
 }
 
+// see `cache.h`.
 // 新增cache_allocg函数，用于在特定块组内分配数据块
-static usize cache_allocg(OpContext *ctx, u32 gno) {
+// 如果目标块`goal`位于该块组内，则从`goal`开始查找，否则从该块组的分配游标开始查找
+static usize cache_allocg(OpContext *ctx, u32 gno, usize goal) {
     assert(gno < NGROUPS);
-    for (usize i = 0; i < sblock->blocks_per_group; i += BIT_PER_BLOCK) {
-        usize block_no = sblock->bg_start + 
-                         sblock->bitmap_start_per_group + gno * sblock->blocks_per_group +
-                         i / BIT_PER_BLOCK;
-        Block *block = cache_acquire(block_no);
+    usize group_start = sblock->bg_start + gno * sblock->blocks_per_group;
+    usize start = get_rotor(gno);
+    if (goal >= group_start && goal < group_start + sblock->blocks_per_group)
+        start = goal - group_start;
+    return alloc_from(ctx, gno, start);
+}
 
-        BitmapCell *bitmap = (BitmapCell *)block->data;
-        for (usize j = 0; j < BIT_PER_BLOCK && j < sblock->blocks_per_group; j++) {
-            if (!bitmap_get(bitmap, j)) {
-                bitmap_set(bitmap, j);
-                cache_sync(ctx, block);
-                cache_release(block);
+// 在块组`gno`的组内偏移区间`[begin, end)`中查找第一个长度不小于`min`的空闲区间，
+// 分配其中至多`max`个块，并通过`num_blocks`返回分配的块数
+// 空闲区间不跨越位图块。`largest`记录扫描过程中见到的最长空闲区间长度
+static usize alloc_extent_range(OpContext *ctx, usize gno, usize begin, usize end,
+                                usize min, usize max, usize *num_blocks, usize *largest) {
+    usize group_start = sblock->bg_start + gno * sblock->blocks_per_group;
+    while (begin < end) {
+        usize i = begin / BIT_PER_BLOCK * BIT_PER_BLOCK;
+        Block *block = cache_acquire(group_start + sblock->bitmap_start_per_group + i / BIT_PER_BLOCK);
 
-                block_no = sblock->bg_start + gno * sblock->blocks_per_group + i + j;
-                block = cache_acquire(block_no);
-                memset(block->data, 0, BLOCK_SIZE);
-                cache_sync(ctx, block);
-                cache_release(block);
+        BitmapCell *bitmap = (BitmapCell *)block->data;
+        usize size = MIN((usize)BIT_PER_BLOCK, end - i);
+        usize j = begin - i, n = 0;
+
+        // 已释放但尚未检查点的块将空闲区间截断
+        AllocGroup *group = &groups[gno];
+        acquire_spinlock(&group->lock);
+        FreedBlocks *freed = find_freed(group, i / BIT_PER_BLOCK);
+        while ((j = find_next_free(bitmap, freed, size, j)) < size) {
+            usize k = find_next_busy(bitmap, freed, size, j);
+            *largest = MAX(*largest, k - j);
+            if (k - j >= min) {
+                n = MIN(k - j, max);
+                break;
+            }
+            j = k;
+        }
+        release_spinlock(&group->lock);
 
-                used_block[gno]++;
+        if (n > 0) {
+            bitmap_set_range(bitmap, j, j + n);
+            cache_sync(ctx, block);
+            cache_release(block);
 
-                return block_no;
+            // 在缓存中清零只是为了让调用者写入时不必读盘，这些块既不写入日志也不固定，
+            // 可能被换出后读回旧内容，由调用者负责写入这些块
+            usize block_no = group_start + i + j;
+            for (usize t = 0; t < n; t++) {
+                cache_release(cache_acquire_zeroed(block_no + t));
             }
+
+            adjust_free_blocks(gno, -(isize)n);
+            advance_rotor(gno, i + j, n);
+
+            *num_blocks = n;
+            return block_no;
         }
 
         cache_release(block);
+        begin = i + BIT_PER_BLOCK;
+    }
+    return 0;
+}
+
+// see `cache.h`.
+// 从目标块所在块组开始按块组顺序查找，块组内先从目标块处开始，再从块组头开始完整扫描一遍
+static usize cache_alloc_extent(OpContext *ctx, usize goal, usize min, usize max, usize *num_blocks) {
+    assert(0 < min && min <= max);
+
+    usize gno = 0, start = get_rotor(0);
+    if (goal >= sblock->bg_start) {
+        usize offset = goal - sblock->bg_start;
+        if (offset < sblock->num_groups * sblock->blocks_per_group) {
+            gno = offset / sblock->blocks_per_group;
+            start = offset % sblock->blocks_per_group;
+        }
+    }
+
+    for (usize t = 0; t < sblock->num_groups; t++) {
+        AllocGroup *group = &groups[gno];
+        acquire_spinlock(&group->lock);
+        bool skip = group->largest_free < min;
+        u32 num_frees = group->num_frees;
+        release_spinlock(&group->lock);
+
+        if (!skip) {
+            usize largest = 0;
+            usize block_no = alloc_extent_range(ctx, gno, start, sblock->blocks_per_group,
+                                                min, max, num_blocks, &largest);
+            if (block_no == 0) {
+                largest = 0;
+                block_no = alloc_extent_range(ctx, gno, 0, sblock->blocks_per_group,
+                                              min, max, num_blocks, &largest);
+            }
+            if (block_no != 0)
+                return block_no;
+
+            // 完整扫描了整个块组，若期间没有释放块，则更新该块组的最长空闲区间长度
+            acquire_spinlock(&group->lock);
+            if (group->num_frees == num_frees)
+                group->largest_free = (u32)largest;
+            release_spinlock(&group->lock);
+        }
+
+        gno = (gno + 1) % sblock->num_groups;
+        start = get_rotor(gno);
     }
     return 0;
 }
@@ -453,20 +1476,45 @@ static void cache_free(OpContext *ctx, usize block_no) {
     BitmapCell *bitmap = (BitmapCell *)block->data;
     assert(bitmap_get(bitmap, j));
     bitmap_clear(bitmap, j);
-    used_block[h]--;
+
+    // 在释放检查点之前，该块不能再分配
+    AllocGroup *group = &groups[h];
+    acquire_spinlock(&group->lock);
+    FreedBlocks *freed = find_freed(group, i);
+    if (freed == NULL) {
+        freed = alloc_object(&freed_arena);
+        assert(freed != NULL);
+        init_list_node(&freed->node);
+        freed->index = i;
+        bitmap_clear_range(freed->freeing, 0, BIT_PER_BLOCK);
+        bitmap_clear_range(freed->committing, 0, BIT_PER_BLOCK);
+        merge_list(&group->freed, &freed->node);
+    }
+    bitmap_set(freed->freeing, j);
+    release_spinlock(&group->lock);
 
     cache_sync(ctx, block);
     cache_release(block);
+
+    adjust_free_blocks(h, 1);
 }
 
 BlockCache bcache = {
     .get_num_cached_blocks = get_num_cached_blocks,
+    .configure = cache_configure,
     .acquire = cache_acquire,
+    .acquire_zeroed = cache_acquire_zeroed,
+    .prefetch = cache_prefetch,
     .release = cache_release,
     .begin_op = cache_begin_op,
+    .get_free_log_space = cache_get_free_log_space,
     .sync = cache_sync,
+    .sync_data = cache_sync_data,
     .end_op = cache_end_op,
+    .flush = cache_flush,
+    .commit_if_due = cache_commit_if_due,
     .alloc = cache_alloc,
     .allocg = cache_allocg,
+    .alloc_extent = cache_alloc_extent,
     .free = cache_free,
 };
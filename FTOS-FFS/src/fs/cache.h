@@ -5,33 +5,70 @@
 #include <fs/block_device.h>
 #include <fs/defines.h>
 
-// maximum number of distinct blocks that one atomic operation can hold.
+// number of log entries reserved by atomic operations that only update a few
+// metadata blocks, e.g. creating or removing a file.
 #define OP_MAX_NUM_BLOCKS 10
 
-// if the number of cached blocks is no less than this threshold, we can
-// evict some blocks in `acquire` to keep block cache small.
-#define EVICTION_THRESHOLD 20
+// the default capacity of block cache, i.e. the number of blocks it holds
+// when no block is acquired or pinned. It can be changed by `configure`.
+#ifndef BCACHE_CAPACITY
+#define BCACHE_CAPACITY 1024
+#endif
+
+// replacement policies of block cache.
+typedef enum {
+    BCACHE_POLICY_CLOCK,  // second-chance CLOCK.
+    BCACHE_POLICY_ARC,    // adaptive replacement cache, which resists scans.
+} BlockCachePolicy;
+
+// the default replacement policy of block cache.
+#ifndef BCACHE_POLICY
+#define BCACHE_POLICY BCACHE_POLICY_ARC
+#endif
+
+// the block cache is split into `BCACHE_NUM_SHARDS` shards by block number.
+// each shard has its own lock, a hash table of `BCACHE_NUM_BUCKETS` buckets
+// and its own share of the capacity.
+#define BCACHE_NUM_SHARDS  8
+#define BCACHE_NUM_BUCKETS 64
+
+// committed atomic operations are checkpointed as a group, when the log has
+// no room for another atomic operation, or when `BCACHE_COMMIT_INTERVAL`
+// milliseconds have passed since the last group commit, or when `flush` is
+// called. The interval is checked when an atomic operation ends and by
+// `commit_if_due`, which the kernel flusher calls on every clock tick.
+#ifndef BCACHE_COMMIT_INTERVAL
+#define BCACHE_COMMIT_INTERVAL 1000
+#endif
 
 typedef struct {
-    // accesses to the following 4 members should be guarded by the lock
-    // of the block cache.
+    // accesses to the following 7 members should be guarded by the lock
+    // of the shard that `block_no` belongs to.
     usize block_no;
-    ListNode node;
-    bool acquired;  // is the block already acquired by some thread?
-    bool pinned;    // if a block is pinned, it should not be evicted from the cache.
-
-    SleepLock lock;  // this lock protects `valid` and `data`.
-    bool valid;      // is the content of block loaded from disk?
-    u8 data[BLOCK_SIZE];
+    ListNode node;    // in one of the lists of the replacement policy.
+    ListNode chain;   // in the hash bucket of its shard.
+    usize refcnt;     // number of threads that acquired or are waiting for the block.
+    usize pinned;     // number of pins. A pinned block should not be evicted from the cache.
+    u8 state;         // private to the replacement policy.
+    bool prefetched;  // loaded by `prefetch` and not acquired since then.
+
+    SleepLock lock;    // this lock protects `valid`, `req` and `data`.
+    bool valid;        // is the content of block loaded from disk?
+    BlockRequest req;  // for asynchronous I/O of `data`.
+
+    // the device transfers from/to `data` directly, so it is kept apart from
+    // other fields and other blocks by cache line alignment.
+    u8 data[BLOCK_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
 } Block;
 
 // `OpContext` represents an atomic operation.
 // see `begin_op` and `end_op`.
 typedef struct {
     SpinLock lock;
-    usize ts;                           // the timestamp/identifier allocated by `begin_op`.
-    usize num_blocks;                   // number of blocks in `block_no` array, i.e. log entries.
-    usize block_no[OP_MAX_NUM_BLOCKS];  // blocks associated with this atomic operation.
+    usize ts;                      // the timestamp/identifier allocated by `begin_op`.
+    usize num_reserved;            // number of log entries reserved by `begin_op`.
+    usize num_blocks;              // number of blocks in `block_no` array, i.e. log entries.
+    u32 block_no[LOG_MAX_SIZE];    // blocks associated with this atomic operation.
 } OpContext;
 
 typedef struct BlockCache {
@@ -40,10 +77,25 @@ typedef struct BlockCache {
     // or the number of allocated `Block` struct.
     usize (*get_num_cached_blocks)();
 
+    // set the capacity (in blocks) and the replacement policy of block cache.
+    // all cached blocks are dropped, so no block should be acquired or pinned.
+    // `init_bcache` starts with `BCACHE_CAPACITY` and `BCACHE_POLICY`.
+    void (*configure)(usize capacity, BlockCachePolicy policy);
+
     // read the content of block at `block_no` from disk, and lock the block.
     // return the pointer to the locked block.
     Block *(*acquire)(usize block_no);
 
+    // like `acquire`, but the block is filled with zeros instead of being read
+    // from disk. It is for blocks whose old content is useless, e.g. newly
+    // allocated blocks.
+    Block *(*acquire_zeroed)(usize block_no);
+
+    // load blocks in `block_nos` into cache ahead of their use, without locking them.
+    // blocks that are already cached are skipped. A prefetched block is not
+    // regarded as accessed by the replacement policy until it is acquired.
+    void (*prefetch)(const usize *block_nos, usize count);
+
     // unlock `block`.
     // NOTE: it does not need to write the block content back to disk.
     void (*release)(Block *block);
@@ -56,12 +108,21 @@ typedef struct BlockCache {
     // * checkpointed: all modifications have been already persisted to disk.
     //
     // `begin_op` creates a new running atomic operation.
-    // `end_op` commits an atomic operation, and waits for it to be checkpointed.
+    // `end_op` commits an atomic operation, which will be checkpointed together
+    // with other committed atomic operations later.
+    // `flush` waits for all committed atomic operations to be checkpointed.
 
     // begin a new atomic operation and initialize `ctx`.
     // `OpContext` represents an outstanding atomic operation. You can mark the
     // end of atomic operation by `end_op`.
-    void (*begin_op)(OpContext *ctx);
+    // `num_blocks` is an estimate of distinct blocks that the atomic operation
+    // syncs through log. It waits until `num_blocks` log entries are reserved,
+    // and syncing more blocks than that is a fatal error.
+    void (*begin_op)(OpContext *ctx, usize num_blocks);
+
+    // return the number of log entries that `begin_op` can reserve without
+    // waiting. It is only a hint, since other threads may reserve them too.
+    usize (*get_free_log_space)();
 
     // synchronize the content of `block` to disk.
     // `ctx` can be NULL, which indicates this operation does not belong to any
@@ -73,10 +134,30 @@ typedef struct BlockCache {
     // NOTE: the caller must hold the lock of `block`.
     void (*sync)(OpContext *ctx, Block *block);
 
+    // synchronize the content of data block `block` in ordered mode, i.e. it
+    // is written in place before `ctx` commits, instead of going through log.
+    // if `block` has log entries of other atomic operations, which may
+    // overwrite it with older content later, it falls back to `sync`.
+    //
+    // NOTE: the caller must hold the lock of `block`.
+    void (*sync_data)(OpContext *ctx, Block *block);
+
     // end the atomic operation managed by `ctx`.
-    // it returns when all associated blocks are persisted to disk.
+    // it returns once the operation is committed. Associated blocks are
+    // persisted to disk by a later group commit, see `BCACHE_COMMIT_INTERVAL`.
     void (*end_op)(OpContext *ctx);
 
+    // force a group commit, and return when all atomic operations that were
+    // begun before are persisted to disk.
+    // NOTE: the caller should not be inside an atomic operation.
+    void (*flush)();
+
+    // start a group commit if committed atomic operations have waited for
+    // `BCACHE_COMMIT_INTERVAL` milliseconds since the last one. It does not
+    // wait for running atomic operations: the last of them to end commits.
+    // NOTE: the caller should not be inside an atomic operation.
+    void (*commit_if_due)();
+
     // NOTES FOR BITMAP
     //
     // every block on disk has a bit in bitmap, including blocks inside bitmap!
@@ -90,7 +171,20 @@ typedef struct BlockCache {
     // block number is returned.
     usize (*alloc)(OpContext *ctx);
 
-    usize (*allocg)(OpContext *ctx, u32 gno);
+    // allocate a new zero-initialized block in group `gno`. The search starts
+    // from `goal` if it lives in that group, otherwise from where the last
+    // allocation in that group stopped. `goal` can be 0 if there is no goal.
+    // 0 is returned if the group is full.
+    usize (*allocg)(OpContext *ctx, u32 gno, usize goal);
+
+    // allocate a run of at least `min` and at most `max` contiguous blocks,
+    // searching from `goal` (can be 0) and then the following groups. the
+    // number of blocks allocated is stored in `*num_blocks` and the first
+    // block number is returned, or 0 if there is no long enough free run.
+    // only one bitmap block is logged per call. The contents of the blocks are
+    // NOT logged and may be stale, so the caller must write every byte it will
+    // read back in the same atomic operation.
+    usize (*alloc_extent)(OpContext *ctx, usize goal, usize min, usize max, usize *num_blocks);
 
     // mark block at `block_no` is free in bitmap.
     void (*free)(OpContext *ctx, usize block_no);
@@ -13,7 +13,7 @@
 #define SECT_SIZE 512
 
 // maximum number of distinct block numbers can be recorded in the log header.
-#define LOG_MAX_SIZE ((BLOCK_SIZE - sizeof(usize)) / sizeof(usize))
+#define LOG_MAX_SIZE ((BLOCK_SIZE - 2 * sizeof(u32)) / sizeof(u32))
 
 #define INODE_NUM_DIRECT   12
 #define INODE_NUM_INDIRECT (BLOCK_SIZE / sizeof(u32))
@@ -54,10 +54,10 @@ typedef u16 InodeType;
 // } SuperBlock;
 
 // FFS disk layout:
-// [ MBR Block | super block | log blocks | block groups ]
+// [ MBR Block | super block | log blocks | group descriptor table | block groups ]
 
-// [ inode blocks | bitmap blocks | data blocks | ... | inode blocks | bitmap blocks | data blocks ]
-// \---------------- block group ---------------/
+// [ inode blocks | bitmap blocks | inode bitmap | data blocks | ... ]
+// \------------------- block group -------------------/
 typedef struct {
     u32 num_blocks;  // total number of blocks in filesystem.
     u32 num_log_blocks;  // number of blocks for logging, including log header.
@@ -66,18 +66,32 @@ typedef struct {
     u32 blocks_per_group; // number of blocks in a single block group
 
     u32 log_start;       // the first block of logging area.
+    u32 gdt_start;   // the first block of group descriptor table.
     u32 bg_start;    // the first block of block groups.
 
     u32 num_inodeblocks_per_group; // number of inode blocks in a single block group
     u32 num_bitmap_per_group; // number of bitmap blocks in a single block group
     u32 num_datablocks_per_group; // number of data blocks in a single block group
     u32 bitmap_start_per_group; // the first block of bitmap blocks in a single block group
+    u32 ibitmap_start_per_group; // the inode bitmap block in a single block group
     u32 data_start_per_group; // the first block of data blocks in a single block group
 
     // u32 used_block[NGROUPS]; // number of used block in a single block group
 } SuperBlock;
 /* 修改超级块，添加块组相关结构 */
 
+// 块组描述符，所有块组的描述符依次存放在块组描述符表中
+// 描述符表只占一个块，因此块组数不能超过`GROUP_DESC_PER_BLOCK`
+// 空闲inode数和目录数与inode位图一起在原子操作中更新；空闲块数保存在内存中，
+// 在组提交时写入日志。挂载时一次读入
+typedef struct {
+    u32 num_free_blocks;  // number of free data blocks in the group.
+    u32 num_free_inodes;  // number of free inodes in the group.
+    u32 num_dirs;         // number of directories in the group.
+} GroupDesc;
+
+#define GROUP_DESC_PER_BLOCK (BLOCK_SIZE / sizeof(GroupDesc))
+
 // `type == INODE_INVALID` implies this inode is free.
 typedef struct dinode {
     InodeType type;
@@ -100,9 +114,13 @@ typedef struct dirent {
     char name[FILE_NAME_MAX_LENGTH];
 } DirEntry;
 
+// a log header with `num_blocks > 0` is a commit record. It is valid only if
+// `checksum` matches the block numbers and the content of logged blocks, so
+// that the header can be written together with logged blocks.
 typedef struct {
-    usize num_blocks;
-    usize block_no[LOG_MAX_SIZE];
+    u32 num_blocks;
+    u32 checksum;
+    u32 block_no[LOG_MAX_SIZE];
 } LogHeader;
 
 // mkfs only
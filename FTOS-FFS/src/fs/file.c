@@ -65,7 +65,7 @@ void fileclose(struct file *f) {
         ;  // pipeclose(ff.pipe, ff.writable);
     else if (ff.type == FD_INODE) {
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, inodes.put_log_blocks(ff.ip));
         inodes.put(&ctx, ff.ip);
         bcache.end_op(&ctx);
     }
@@ -104,6 +104,32 @@ isize fileread(struct file *f, char *addr, isize n) {
     return -1;
 }
 
+/*
+ * Maximum number of data blocks written in one atomic operation.
+ * File data is written in place rather than logged, so this mainly
+ * bounds how long the i-node stays locked. Log space is reserved for
+ * data blocks only in case they have to be logged.
+ */
+#define FILEWRITE_MAX_BLOCKS 32
+
+/*
+ * Estimate the log entries needed to write num_data data blocks.
+ * Blocks of the delayed allocation buffer may be written in the same
+ * operation. Each allocated block may come from a different block
+ * group and log its bitmap block, and so may the indirect block. A
+ * data block written in place still takes a log entry when another
+ * operation has logged it. The i-node and the indirect block are
+ * logged as well. The group descriptor table joins the log at group
+ * commit, in a log entry of its own.
+ */
+static usize filewrite_log_blocks(usize num_data) {
+    usize num_alloc = num_data + INODE_DELAY_MAX_BLOCKS;
+    usize num_inode = 1;
+    usize num_indirect = 1;
+    usize num_bitmap = MIN(num_alloc + num_indirect, (usize)NGROUPS);
+    return num_inode + num_indirect + num_bitmap + num_alloc;
+}
+
 /* Write to file f. */
 isize filewrite(struct file *f, char *addr, isize n) {
     isize r;
@@ -113,23 +139,24 @@ isize filewrite(struct file *f, char *addr, isize n) {
     // if (f->type == FD_PIPE)
     //     return pipewrite(f->pipe, addr, n);
     if (f->type == FD_INODE) {
-        /*
-         * Write a few blocks at a time to avoid exceeding
-         * the maximum log transaction size, including
-         * i-node, indirect block, allocation blocks,
-         * and 2 blocks of slop for non-aligned writes.
-         * This really belongs lower down, since writei()
-         * might be writing a device like the console.
-         */
-        isize max = ((INODE_MAX_BLOCKS - 1 - 1 - 2) / 2) * 512;
         isize i = 0;
         while (i < n) {
+            /*
+             * Shrink the chunk while its metadata does not fit in the
+             * free log space. A non-aligned chunk touches 1 more block.
+             */
+            usize num_data = FILEWRITE_MAX_BLOCKS;
+            usize free_space = bcache.get_free_log_space();
+            while (num_data > 1 && filewrite_log_blocks(num_data + 1) > free_space)
+                num_data /= 2;
+
+            isize max = (isize)(num_data * BLOCK_SIZE);
             isize n1 = n - i;
             if (n1 > max)
                 n1 = max;
 
             OpContext ctx;
-            bcache.begin_op(&ctx);
+            bcache.begin_op(&ctx, filewrite_log_blocks(num_data + 1));
             inodes.lock(f->ip);
 
             r = (isize)inodes.write(&ctx, f->ip, (u8 *)(addr + i), f->off, (usize)n1);
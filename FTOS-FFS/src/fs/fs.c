@@ -4,31 +4,15 @@
 #include <fs/fs.h>
 #include <fs/inode.h>
 #include <fs/used_block.h>
-#include <common/bitmap.h>
-
-static u8 used_block_data[BLOCK_SIZE];
-extern u32 used_block[NGROUPS];
 
 void init_filesystem() {
     init_block_device();
     // printf("init_block_device finished.\n");
     const SuperBlock *sblock = get_super_block();
+    // 各块组的已使用数据块数由`init_bcache`从块组描述符表中读入
     init_bcache(sblock, &block_device);
 
-    u32 i, j, h;
-    for (h = 0; h < NGROUPS; h++) {
-        for (i = 0; i < sblock->blocks_per_group; i += BIT_PER_BLOCK) {
-            block_device.read(sblock->bg_start + 
-                              h * sblock->blocks_per_group + 
-                              sblock->bitmap_start_per_group +
-                              i / BIT_PER_BLOCK, used_block_data);
-            BitmapCell *bitmap = (BitmapCell *)used_block_data;
-            for (j = sblock->data_start_per_group; i + j < BIT_PER_BLOCK && j < sblock->blocks_per_group; j++) {
-                if (bitmap_get(bitmap, j))  {
-                    used_block[h]++;
-                }
-            }
-        }
+    for (u32 h = 0; h < sblock->num_groups; h++) {
         printf("group %u used_block: %u\n", h, used_block[h]);
     }
     // printf("init_bcache finished.\n");
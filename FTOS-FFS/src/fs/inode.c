@@ -1,3 +1,4 @@
+#include <common/bitmap.h>
 #include <common/string.h>
 #include <core/arena.h>
 #include <core/console.h>
@@ -6,10 +7,45 @@
 #include <fs/inode.h>
 #include <fs/used_block.h>
 
-// this lock mainly prevents concurrent access to inode list `head`, reference
-// count increment and decrement.
-static SpinLock lock;
-static ListNode head;
+// a hash bucket of in-memory inodes. The lock prevents concurrent access to
+// the list `head` and orders reference count changes to zero against lookups.
+typedef struct {
+    SpinLock lock;
+    ListNode head;
+} InodeBucket;
+
+static InodeBucket buckets[INODE_NUM_BUCKETS];
+
+// unreferenced inodes kept in memory, the most recently used one first.
+// `lru_lock` protects `lru`, `num_unused` and `deferred`. It is always
+// acquired after a bucket lock.
+static SpinLock lru_lock;
+static ListNode lru;
+static usize num_unused;
+
+// 原子操作中预留的日志项不足以写回或释放inode时，`put`不放弃最后一个引用，
+// 而是将inode链入此表，由`flush_all`在单独的原子操作中放弃
+static ListNode deferred;
+
+// `flush_all`的趟数，每趟只写回开始前已有延迟数据的inode
+static usize flush_pass;
+
+// a cached result of looking up `name` in directory `parent`.
+typedef struct {
+    ListNode chain;  // in the hash bucket of (`parent`, `name`).
+    ListNode lru;    // in `dcache_lru`.
+    usize parent;    // 0 if this slot is unused.
+    char name[FILE_NAME_MAX_LENGTH];
+    usize inode_no;  // 0 for a negative entry, i.e. `name` is not in `parent`.
+    usize index;     // index of the directory entry if `inode_no` is not 0.
+} DcacheEntry;
+
+// `dcache_lock` protects the whole dentry cache. Entries are only changed
+// under the lock of their parent directory as well.
+static SpinLock dcache_lock;
+static ListNode dcache_buckets[INODE_DCACHE_NUM_BUCKETS];
+static ListNode dcache_lru;  // all slots, the most recently used one first.
+static DcacheEntry dcache_entries[INODE_DCACHE_SIZE];
 
 static const SuperBlock *sblock;
 static const BlockCache *cache;
@@ -24,6 +60,92 @@ static Arena arena;
 
 extern u32 used_block[NGROUPS];
 
+// 每个块组的inode分配状态，由块组各自的锁保护
+typedef struct {
+    SpinLock lock;
+    u32 num_free;  // 空闲inode数，与块组描述符一致
+} InodeGroup;
+
+static InodeGroup groups[NGROUPS];
+
+// return the hash bucket of `inode_no`.
+static INLINE InodeBucket *get_bucket(usize inode_no) {
+    return &buckets[inode_no % INODE_NUM_BUCKETS];
+}
+
+// return the dentry cache bucket of `name` in directory `parent`.
+// only the first `FILE_NAME_MAX_LENGTH` characters count, as in `DirEntry`.
+static INLINE ListNode *get_dcache_bucket(usize parent, const char *name) {
+    usize hash = parent;
+    for (usize i = 0; i < FILE_NAME_MAX_LENGTH && name[i] != '\0'; i++)
+        hash = hash * 31 + (u8)name[i];
+    return &dcache_buckets[hash % INODE_DCACHE_NUM_BUCKETS];
+}
+
+// return the cached entry of `name` in directory `parent`, or NULL.
+//
+// NOTE: caller must hold `dcache_lock`.
+static DcacheEntry *dcache_find(usize parent, const char *name) {
+    ListNode *bucket = get_dcache_bucket(parent, name);
+    for (ListNode *cur = bucket->next; cur != bucket; cur = cur->next) {
+        DcacheEntry *dentry = container_of(cur, DcacheEntry, chain);
+        if (dentry->parent == parent && strncmp(name, dentry->name, FILE_NAME_MAX_LENGTH) == 0)
+            return dentry;
+    }
+    return NULL;
+}
+
+// look up `name` in directory `parent` in the dentry cache.
+// on a hit, return true and copy the cached result to `*inode_no` and `*index`.
+static bool dcache_lookup(usize parent, const char *name, usize *inode_no, usize *index) {
+    acquire_spinlock(&dcache_lock);
+    DcacheEntry *dentry = dcache_find(parent, name);
+    if (dentry != NULL) {
+        *inode_no = dentry->inode_no;
+        *index = dentry->index;
+        detach_from_list(&dentry->lru);
+        merge_list(&dcache_lru, &dentry->lru);
+    }
+    release_spinlock(&dcache_lock);
+    return dentry != NULL;
+}
+
+// remember that `name` in directory `parent` is `inode_no` at `index`, or
+// that it does not exist if `inode_no` is 0. The least recently used slot is
+// reused if `name` is not cached yet.
+static void dcache_insert(usize parent, const char *name, usize inode_no, usize index) {
+    acquire_spinlock(&dcache_lock);
+    DcacheEntry *dentry = dcache_find(parent, name);
+    if (dentry == NULL) {
+        dentry = container_of(dcache_lru.prev, DcacheEntry, lru);
+        detach_from_list(&dentry->chain);
+        dentry->parent = parent;
+        strncpy(dentry->name, name, FILE_NAME_MAX_LENGTH);
+        merge_list(get_dcache_bucket(parent, name), &dentry->chain);
+    }
+    dentry->inode_no = inode_no;
+    dentry->index = index;
+    detach_from_list(&dentry->lru);
+    merge_list(&dcache_lru, &dentry->lru);
+    release_spinlock(&dcache_lock);
+}
+
+// forget all entries in directory `inode_no` and all entries pointing to it.
+static void dcache_purge(usize inode_no) {
+    acquire_spinlock(&dcache_lock);
+    for (usize i = 0; i < INODE_DCACHE_SIZE; i++) {
+        DcacheEntry *dentry = &dcache_entries[i];
+        if (dentry->parent != 0 && (dentry->parent == inode_no || dentry->inode_no == inode_no)) {
+            detach_from_list(&dentry->chain);
+            dentry->parent = 0;
+            // unused slots are reused first.
+            detach_from_list(&dentry->lru);
+            merge_list(dcache_lru.prev, &dentry->lru);
+        }
+    }
+    release_spinlock(&dcache_lock);
+}
+
 // return which block `inode_no` lives on.
 static INLINE usize to_block_no(usize inode_no) {
     // inode所在的块编号 = 
@@ -50,16 +172,48 @@ static INLINE void set_flag(bool *flag) {
         *flag = true;
 }
 
+// `ctx`中尚未使用的预留日志项是否不少于`num_blocks`
+static INLINE bool has_log_space(OpContext *ctx, usize num_blocks) {
+    return ctx->num_reserved - ctx->num_blocks >= num_blocks;
+}
+
 // initialize inode tree.
 void init_inodes(const SuperBlock *_sblock, const BlockCache *_cache) {
     ArenaPageAllocator allocator = {.allocate = kalloc, .free = kfree};
 
-    init_spinlock(&lock, "inode tree");
-    init_list_node(&head);
+    for (usize i = 0; i < INODE_NUM_BUCKETS; i++) {
+        init_spinlock(&buckets[i].lock, "inode bucket");
+        init_list_node(&buckets[i].head);
+    }
+    init_spinlock(&lru_lock, "inode lru");
+    init_list_node(&lru);
+    num_unused = 0;
+    init_list_node(&deferred);
+
+    init_spinlock(&dcache_lock, "dcache");
+    for (usize i = 0; i < INODE_DCACHE_NUM_BUCKETS; i++)
+        init_list_node(&dcache_buckets[i]);
+    init_list_node(&dcache_lru);
+    for (usize i = 0; i < INODE_DCACHE_SIZE; i++) {
+        DcacheEntry *dentry = &dcache_entries[i];
+        init_list_node(&dentry->chain);
+        init_list_node(&dentry->lru);
+        dentry->parent = 0;
+        merge_list(&dcache_lru, &dentry->lru);
+    }
     sblock = _sblock;
     cache = _cache;
     init_arena(&arena, sizeof(Inode), allocator);
 
+    // 从块组描述符表中读入各块组的空闲inode数
+    Block *block = cache->acquire(sblock->gdt_start);
+    GroupDesc *desc = (GroupDesc *)block->data;
+    for (usize i = 0; i < sblock->num_groups; i++) {
+        init_spinlock(&groups[i].lock, "inode group");
+        groups[i].num_free = desc[i].num_free_inodes;
+    }
+    cache->release(block);
+
     if (ROOT_INODE_NO < sblock->num_inodes)
         inodes.root = inodes.get(ROOT_INODE_NO);
     else
@@ -71,28 +225,99 @@ static void init_inode(Inode *inode) {
     init_spinlock(&inode->lock, "inode");
     init_rc(&inode->rc);
     init_list_node(&inode->node);
+    init_list_node(&inode->lru);
     inode->inode_no = 0;
     inode->valid = false;
+    inode->ra_offset = 0;
+    inode->ra_window = 0;
+    inode->ra_end = 0;
+    inode->delay_data = NULL;
+    inode->delay_begin = 0;
+    inode->delay_pass = 0;
+}
+
+// 在原子操作中修改`inode_no`所在块组的描述符，空闲inode数增加`delta`，
+// 类型为`type`的目录数相应减少`delta`，并同步内存中的空闲inode数
+// NOTE: 持有描述符表块期间不能再获取其他块
+static void adjust_free_inodes(OpContext *ctx, usize inode_no, InodeType type, isize delta) {
+    usize gno = (inode_no - 1) / GINODES;
+    Block *block = cache->acquire(sblock->gdt_start);
+    GroupDesc *desc = (GroupDesc *)block->data + gno;
+    desc->num_free_inodes = (u32)((isize)desc->num_free_inodes + delta);
+    if (type == INODE_DIRECTORY)
+        desc->num_dirs = (u32)((isize)desc->num_dirs - delta);
+
+    InodeGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    group->num_free = desc->num_free_inodes;
+    release_spinlock(&group->lock);
+
+    cache->sync(ctx, block);
+    cache->release(block);
+}
+
+// 返回块组`gno`的inode位图块编号
+static INLINE usize to_ibitmap_no(usize gno) {
+    return sblock->bg_start + gno * sblock->blocks_per_group + sblock->ibitmap_start_per_group;
+}
+
+// 在块组`gno`中按字查找inode位图，分配一个类型为`type`的inode
+// 返回inode编号，块组中没有空闲inode时返回0
+static usize alloc_in_group(OpContext *ctx, usize gno, InodeType type) {
+    // 根据内存中的空闲inode数跳过已满的块组，无需读取位图
+    InodeGroup *group = &groups[gno];
+    acquire_spinlock(&group->lock);
+    bool full = group->num_free == 0;
+    release_spinlock(&group->lock);
+    if (full)
+        return 0;
+
+    // 位图的修改由inode位图块的锁串行化
+    Block *block = cache->acquire(to_ibitmap_no(gno));
+    BitmapCell *bitmap = (BitmapCell *)block->data;
+    usize i = bitmap_find_first_zero(bitmap, GINODES);
+    if (i >= GINODES) {
+        cache->release(block);
+        return 0;
+    }
+    bitmap_set(bitmap, i);
+    cache->sync(ctx, block);
+    cache->release(block);
+
+    usize ino = gno * GINODES + i + 1;
+    block = cache->acquire(to_block_no(ino));
+    InodeEntry *inode = get_entry(block, ino);
+    assert(inode->type == INODE_INVALID);
+    memset(inode, 0, sizeof(InodeEntry));
+    inode->type = type;
+    cache->sync(ctx, block);
+    cache->release(block);
+
+    adjust_free_inodes(ctx, ino, type, -1);
+    return ino;
+}
+
+// 在inode位图中释放`inode_no`，`type`为其原来的类型
+static void free_inode(OpContext *ctx, usize inode_no, InodeType type) {
+    usize gno = (inode_no - 1) / GINODES;
+    Block *block = cache->acquire(to_ibitmap_no(gno));
+    BitmapCell *bitmap = (BitmapCell *)block->data;
+    usize i = (inode_no - 1) % GINODES;
+    assert(bitmap_get(bitmap, i));
+    bitmap_clear(bitmap, i);
+    cache->sync(ctx, block);
+    cache->release(block);
+
+    adjust_free_inodes(ctx, inode_no, type, 1);
 }
 
 // see `inode.h`.
 static usize inode_alloc(OpContext *ctx, InodeType type) {
     assert(type != INODE_INVALID);
-    for (usize ino = 1; ino <= sblock -> num_inodes; ino++) {
-        usize block_no = to_block_no(ino);
-        // printf("inode %u in block %u\n", ino, block_no);
-        Block *block = cache->acquire(block_no);
-        InodeEntry *inode = get_entry(block, ino);
-
-        if (inode->type == INODE_INVALID) {
-            memset(inode, 0, sizeof(InodeEntry));
-            inode->type = type;
-            cache->sync(ctx, block);
-            cache->release(block);
+    for (usize gno = 0; gno < sblock->num_groups; gno++) {
+        usize ino = alloc_in_group(ctx, gno, type);
+        if (ino != 0)
             return ino;
-        }
-
-        cache->release(block);
     }
     return 0;
 }
@@ -106,46 +331,23 @@ static usize inode_alloc_group(OpContext *ctx, InodeType type, u32 gno) {
     // 针对type为目录的情况，自动调整gno为最空闲的块组编号
     // 否则直接在编号为gno的块组中分配inode
     if (type == INODE_DIRECTORY) {
-        u32 i, used = FSSIZE;
+        u32 used = FSSIZE;
         // 遍历所有块组，通过used_block信息获取最空闲的块组编号
-        for (i = 0; i < NGROUPS; i++) {
+        for (u32 i = 0; i < NGROUPS; i++) {
             if (used_block[i] < used) {
                 used = used_block[i];
                 gno = i;
             }
         }
-        if (i == NGROUPS)
-            return 0;
     }
 
     // printf("inode_allog gno: %u\n", gno);
 
-    // ino的含义变为某一块组内相对的inode编号
-    // ino在块组内顺序分配
+    // 从gno开始按组查找inode位图
     for (; gno < NGROUPS; gno++) {
-        for (usize ino = 1; ino <= GINODES; ino++) {
-            // tino为换算后的实际inode编号
-            usize tino = ino + gno * (NINODES / NGROUPS);
-
-            assert(tino <= NINODES);
-
-            // 获取待分配的inode所在的块编号
-            usize block_no = to_block_no(tino);
-            // printf("inode %u in block %u\n", ino, block_no);
-            Block *block = cache->acquire(block_no);
-            InodeEntry *inode = get_entry(block, tino);
-
-            // 找到空闲inode，进行分配并返回此inode编号
-            if (inode->type == INODE_INVALID) {
-                memset(inode, 0, sizeof(InodeEntry));
-                inode->type = type;
-                cache->sync(ctx, block);
-                cache->release(block); 
-                return tino;
-            }
-
-            cache->release(block);
-        }
+        usize ino = alloc_in_group(ctx, gno, type);
+        if (ino != 0)
+            return ino;
     }
     // 这里表明分配失败
     return 0;
@@ -153,6 +355,14 @@ static usize inode_alloc_group(OpContext *ctx, InodeType type, u32 gno) {
 
 
 
+// 返回磁盘上`inode`的文件长度，延迟分配的数据尚未写入磁盘，不计入其中
+static INLINE usize disk_size(Inode *inode) {
+    usize num_bytes = inode->entry.num_bytes;
+    if (inode->delay_data != NULL)
+        num_bytes = MIN(num_bytes, inode->delay_begin * BLOCK_SIZE);
+    return num_bytes;
+}
+
 // see `inode.h`.
 static void inode_sync(OpContext *ctx, Inode *inode, bool do_write) {
     usize block_no = to_block_no(inode->inode_no);
@@ -161,6 +371,7 @@ static void inode_sync(OpContext *ctx, Inode *inode, bool do_write) {
 
     if (inode->valid && do_write) {
         memcpy(entry, &inode->entry, sizeof(InodeEntry));
+        entry->num_bytes = (u32)disk_size(inode);
         cache->sync(ctx, block);
     } else if (!inode->valid) {
         memcpy(&inode->entry, entry, sizeof(InodeEntry));
@@ -187,16 +398,50 @@ static void inode_unlock(Inode *inode) {
     release_spinlock(&inode->lock);
 }
 
+// free the least recently used unreferenced inode.
+// `held` is the bucket whose lock the caller holds. Other buckets are only
+// tried, and inodes in busy buckets are skipped, so that the lock order is
+// kept. Return false if nothing can be freed.
+static bool evict_inode(InodeBucket *held) {
+    acquire_spinlock(&lru_lock);
+    for (ListNode *cur = lru.prev; cur != &lru; cur = cur->prev) {
+        Inode *inst = container_of(cur, Inode, lru);
+        InodeBucket *bucket = get_bucket(inst->inode_no);
+        if (bucket != held && !try_acquire_spinlock(&bucket->lock))
+            continue;
+
+        detach_from_list(&inst->lru);
+        num_unused--;
+        detach_from_list(&inst->node);
+        if (bucket != held)
+            release_spinlock(&bucket->lock);
+        release_spinlock(&lru_lock);
+
+        free_object(inst);
+        return true;
+    }
+    release_spinlock(&lru_lock);
+    return false;
+}
+
 // see `inode.h`.
 static Inode *inode_get(usize inode_no) {
     assert(inode_no > 0);
     assert(inode_no <= sblock->num_inodes);
-    acquire_spinlock(&lock);
+    InodeBucket *bucket = get_bucket(inode_no);
+    acquire_spinlock(&bucket->lock);
 
     Inode *inode = NULL;
-    for (ListNode *cur = head.next; cur != &head; cur = cur->next) {
+    for (ListNode *cur = bucket->head.next; cur != &bucket->head; cur = cur->next) {
         Inode *inst = container_of(cur, Inode, node);
-        if (inst->rc.count > 0 && inst->inode_no == inode_no) {
+        if (inst->inode_no == inode_no) {
+            // take it back from the LRU list. Its entry is still valid.
+            if (inst->rc.count == 0) {
+                acquire_spinlock(&lru_lock);
+                detach_from_list(&inst->lru);
+                num_unused--;
+                release_spinlock(&lru_lock);
+            }
             increment_rc(&inst->rc);
             inode = inst;
             break;
@@ -205,14 +450,16 @@ static Inode *inode_get(usize inode_no) {
 
     if (inode == NULL) {
         inode = alloc_object(&arena);
+        while (inode == NULL && evict_inode(bucket))
+            inode = alloc_object(&arena);
         assert(inode != NULL);
         init_inode(inode);
         inode->inode_no = inode_no;
         increment_rc(&inode->rc);
-        merge_list(&head, &inode->node);
+        merge_list(&bucket->head, &inode->node);
     }
 
-    release_spinlock(&lock);
+    release_spinlock(&bucket->lock);
 
     return inode;
 }
@@ -221,6 +468,11 @@ static Inode *inode_get(usize inode_no) {
 static void inode_clear(OpContext *ctx, Inode *inode) {
     InodeEntry *entry = &inode->entry;
 
+    if (inode->delay_data != NULL) {
+        kfree(inode->delay_data);
+        inode->delay_data = NULL;
+    }
+
     for (usize i = 0; i < INODE_NUM_DIRECT; i++) {
         usize addr = entry->addrs[i];
         if (addr != 0)
@@ -243,39 +495,134 @@ static void inode_clear(OpContext *ctx, Inode *inode) {
     }
 
     entry->num_bytes = 0;
+    inode->ra_end = 0;
     inode_sync(ctx, inode, true);
+
+    // 目录已被清空，其下缓存的查找结果均已失效
+    if (entry->type == INODE_DIRECTORY)
+        dcache_purge(inode->inode_no);
 }
 
 // see `inode.h`.
 static Inode *inode_share(Inode *inode) {
-    acquire_spinlock(&lock);
+    // no lock is needed: the caller holds a reference, so the count cannot
+    // drop to zero under us.
+    assert(inode->rc.count > 0);
     increment_rc(&inode->rc);
-    release_spinlock(&lock);
     return inode;
 }
 
+static void inode_flush(OpContext *ctx, Inode *inode);
+
 // see `inode.h`.
 static void inode_put(OpContext *ctx, Inode *inode) {
-    acquire_spinlock(&lock);
-    bool is_last = inode->rc.count <= 1 && inode->entry.num_links == 0;
+    InodeBucket *bucket = get_bucket(inode->inode_no);
+    acquire_spinlock(&bucket->lock);
+    bool is_final = inode->rc.count <= 1;
+
+    // 放弃最后一个引用前需要知道链接数，尚未读入的inode先从磁盘读入
+    if (is_final && !inode->valid) {
+        inode_lock(inode);
+        inode_unlock(inode);
+    }
+
+    bool is_retired = inode->valid && inode->entry.type == INODE_INVALID;
+    bool is_last = is_final && !is_retired && inode->entry.num_links == 0;
+
+    // 预留的日志项不足时保留这最后一个引用，推迟到`flush_all`
+    bool is_dirty = is_final && !is_last && inode->delay_data != NULL;
+    if ((is_last && !has_log_space(ctx, INODE_FREE_LOG_BLOCKS)) ||
+        (is_dirty && !has_log_space(ctx, INODE_FLUSH_LOG_BLOCKS))) {
+        acquire_spinlock(&lru_lock);
+        merge_list(&deferred, &inode->lru);
+        release_spinlock(&lru_lock);
+        release_spinlock(&bucket->lock);
+        return;
+    }
 
     if (is_last) {
         inode_lock(inode);
-        release_spinlock(&lock);
+        release_spinlock(&bucket->lock);
 
+        usize inode_no = inode->inode_no;
+        InodeType type = inode->entry.type;
         inode_clear(ctx, inode);
         inode->entry.type = INODE_INVALID;
         inode_sync(ctx, inode, true);
+        dcache_purge(inode_no);
 
         inode_unlock(inode);
-        acquire_spinlock(&lock);
+
+        // 先将inode移出哈希表，之后的`get`只会得到新的inode
+        acquire_spinlock(&bucket->lock);
+        detach_from_list(&inode->node);
+        bool is_free = decrement_rc(&inode->rc);
+        release_spinlock(&bucket->lock);
+        if (is_free)
+            free_object(inode);
+
+        // 最后才在inode位图中释放编号，此后它才可能被重新分配
+        free_inode(ctx, inode_no, type);
+        return;
+    }
+
+    if (is_dirty) {
+        // 释放内存中的inode之前为延迟的数据分配块并写入磁盘
+        inode_lock(inode);
+        release_spinlock(&bucket->lock);
+
+        inode_flush(ctx, inode);
+
+        inode_unlock(inode);
+        acquire_spinlock(&bucket->lock);
     }
 
     if (decrement_rc(&inode->rc)) {
-        detach_from_list(&inode->node);
-        free_object(inode);
+        if (is_retired) {
+            // 已被释放并移出哈希表的inode
+            free_object(inode);
+        } else {
+            // keep the clean inode in memory for later `get`s.
+            acquire_spinlock(&lru_lock);
+            merge_list(&lru, &inode->lru);
+            bool overflow = ++num_unused > INODE_CACHE_SIZE;
+            release_spinlock(&lru_lock);
+
+            if (overflow)
+                evict_inode(bucket);
+        }
     }
-    release_spinlock(&lock);
+    release_spinlock(&bucket->lock);
+}
+
+// see `inode.h`.
+static usize inode_put_log_blocks(Inode *inode) {
+    if (inode->valid && inode->entry.num_links == 0)
+        return INODE_FREE_LOG_BLOCKS;
+    if (inode->delay_data != NULL)
+        return INODE_FLUSH_LOG_BLOCKS;
+    return 0;
+}
+
+// 获取第`index`个间接块的目标块组
+static usize indirect_group(usize index) {
+    // 根据间接块编号获取目标块组，默认为下一块组
+    usize tgno =  (index / NINBLOCKS_PER_GROUP + 1) % NGROUPS;
+    usize step = 2;
+    // 优先间隔分配
+    while (used_block[tgno] == sblock->num_datablocks_per_group) {
+        tgno = tgno + step;
+        // 如果间隔分配到达块组尾，则从头开始按相邻块组进行分配
+        if (tgno >= NGROUPS) {
+            tgno = 0;
+            step = 1;
+        }
+        // 无法分配块组，直接跳出，交给allocg函数处理异常
+        if (step == 1 && tgno >= NGROUPS) {
+            break;
+        }
+    }
+    return tgno;
 }
 
 // this function is private to inode layer, because it can allocate block
@@ -299,8 +646,10 @@ static usize inode_map(OpContext *ctx, Inode *inode, usize offset, bool *modifie
     // 小文件，可以完全放置在当前块组中，否则按序查找其他块组
     if (index < INODE_NUM_DIRECT) {
         if (entry->addrs[index] == 0) {
+            // 以前一逻辑块的后继物理块为目标，使文件数据尽量连续存放
+            usize goal = index > 0 && entry->addrs[index - 1] != 0 ? entry->addrs[index - 1] + 1 : 0;
             // 从父目录块组开始顺序寻找可分配块组
-            if ((entry->addrs[index] = (u32)cache->allocg(ctx, gno)) == 0) {
+            if ((entry->addrs[index] = (u32)cache->allocg(ctx, gno, goal)) == 0) {
                 // 否则使用默认alloc函数进行分配
                 entry->addrs[index] = (u32)cache->alloc(ctx);
             }
@@ -315,7 +664,7 @@ static usize inode_map(OpContext *ctx, Inode *inode, usize offset, bool *modifie
 
     // 分配间接块索引块，与小文件处理方式一致
     if (entry->indirect == 0) {
-        if ((entry->indirect = (u32)cache->allocg(ctx, gno)) == 0) {
+        if ((entry->indirect = (u32)cache->allocg(ctx, gno, 0)) == 0) {
             // 否则使用默认alloc函数进行分配
             entry->indirect = (u32)cache->alloc(ctx);
         }
@@ -327,24 +676,12 @@ static usize inode_map(OpContext *ctx, Inode *inode, usize offset, bool *modifie
 
     // 分配间接块，分配逻辑与mkfs中初始用户程序的分配方式类似
     if (addrs[index] == 0) {
-        // 根据间接块编号获取目标块组，默认为下一块组
-        usize tgno =  (index / NINBLOCKS_PER_GROUP + 1) % NGROUPS;
-        usize step = 2;
-        // 优先间隔分配
-        while (used_block[tgno] == sblock->num_datablocks_per_group) {
-            tgno = tgno + step;
-            // 如果间隔分配到达块组尾，则从头开始按相邻块组进行分配
-            if (tgno >= NGROUPS) {
-                tgno = 0;
-                step = 1;
-            }
-            // 无法分配块组，直接跳出，交给allocg函数处理异常
-            if (step == 1 && tgno >= NGROUPS) {
-                break;
-            }
-        }
+        usize tgno = indirect_group(index);
 
-        addrs[index] = (u32)cache->allocg(ctx, (u32)tgno);
+        // 以前一逻辑块的后继物理块为目标，目标不在块组`tgno`内时由allocg忽略
+        usize prev = index > 0 ? addrs[index - 1] : entry->addrs[INODE_NUM_DIRECT - 1];
+        usize goal = prev != 0 ? prev + 1 : 0;
+        addrs[index] = (u32)cache->allocg(ctx, (u32)tgno, goal);
         cache->sync(ctx, block);
         set_flag(modified);
     }
@@ -354,6 +691,131 @@ static usize inode_map(OpContext *ctx, Inode *inode, usize offset, bool *modifie
     return addr;
 }   
 
+// 获取`inode`第`index`个数据块的目标块组
+static usize target_group(Inode *inode, usize index) {
+    if (index < INODE_NUM_DIRECT)
+        return ((u32)inode->inode_no - 1) / (NINODES / NGROUPS);
+    return indirect_group(index - INODE_NUM_DIRECT);
+}
+
+// 为`addrs[begin, end)`中尚未分配的项成批分配连续的块，其中`addrs[i]`对应
+// 逻辑块`base + i`，`prev`为`addrs[begin]`前一逻辑块的块编号。
+// 目标块组相同的连续项一次分配，并以前一逻辑块的后继物理块为目标。
+// 返回是否修改了`addrs`。
+static bool alloc_addrs(OpContext *ctx, Inode *inode, u32 *addrs, usize base,
+                        usize begin, usize end, usize prev) {
+    bool modified = false;
+    usize i = begin;
+    while (i < end) {
+        if (addrs[i] != 0) {
+            prev = addrs[i++];
+            continue;
+        }
+
+        usize gno = target_group(inode, base + i);
+        usize n = 1;
+        while (i + n < end && addrs[i + n] == 0 && target_group(inode, base + i + n) == gno) {
+            n++;
+        }
+
+        usize group_start = sblock->bg_start + gno * sblock->blocks_per_group;
+        usize goal = group_start;
+        if (prev != 0 && prev + 1 >= group_start && prev + 1 < group_start + sblock->blocks_per_group)
+            goal = prev + 1;
+
+        usize num_blocks;
+        usize block_no = cache->alloc_extent(ctx, goal, 1, n, &num_blocks);
+        if (block_no == 0)
+            break;
+
+        for (usize j = 0; j < num_blocks; j++) {
+            addrs[i + j] = (u32)(block_no + j);
+        }
+        modified = true;
+        i += num_blocks;
+        prev = block_no + num_blocks - 1;
+    }
+    return modified;
+}
+
+// allocate data blocks of `[offset, end)` in `inode` in extents, so that a
+// large write only searches bitmap and logs bitmap blocks a few times. Blocks
+// not allocated here are left to `inode_map`.
+//
+// NOTE: blocks allocated are not zero-filled on disk, so this is only used
+// for regular files, whose contents beyond `num_bytes` are never read.
+// NOTE: caller must hold the lock of `inode`.
+static void inode_alloc_extents(OpContext *ctx, Inode *inode, usize offset, usize end, bool *modified) {
+    InodeEntry *entry = &inode->entry;
+    usize begin = offset / BLOCK_SIZE;
+    usize last = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    if (begin < INODE_NUM_DIRECT) {
+        usize prev = begin > 0 ? entry->addrs[begin - 1] : 0;
+        if (alloc_addrs(ctx, inode, entry->addrs, 0, begin, MIN(last, (usize)INODE_NUM_DIRECT), prev))
+            set_flag(modified);
+        begin = INODE_NUM_DIRECT;
+    }
+
+    if (begin >= last)
+        return;
+
+    // 间接索引块仍由`inode_map`分配
+    if (entry->indirect == 0)
+        inode_map(ctx, inode, begin * BLOCK_SIZE, modified);
+
+    Block *block = cache->acquire(entry->indirect);
+    u32 *addrs = get_addrs(block);
+    begin -= INODE_NUM_DIRECT;
+    last -= INODE_NUM_DIRECT;
+    usize prev = begin > 0 ? addrs[begin - 1] : entry->addrs[INODE_NUM_DIRECT - 1];
+    if (alloc_addrs(ctx, inode, addrs, INODE_NUM_DIRECT, begin, last, prev)) {
+        cache->sync(ctx, block);
+        set_flag(modified);
+    }
+    cache->release(block);
+}
+
+// detect sequential reads of `inode` and prefetch blocks after `[offset, end)`
+// into block cache, so that following reads need not wait for the device.
+//
+// NOTE: caller must hold the lock of `inode`.
+static void inode_readahead(Inode *inode, usize offset, usize end) {
+    if (offset != inode->ra_offset) {
+        inode->ra_window = 0;
+        inode->ra_end = 0;
+    } else if (inode->ra_window == 0)
+        inode->ra_window = INODE_READAHEAD_MIN;
+    else
+        inode->ra_window = MIN(inode->ra_window * 2, (usize)INODE_READAHEAD_MAX);
+    inode->ra_offset = end;
+
+    if (inode->ra_window == 0)
+        return;
+
+    // read ahead only when the reader gets into the second half of the window.
+    usize next = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    usize num_blocks = (disk_size(inode) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (inode->ra_end > next + inode->ra_window / 2)
+        return;
+
+    usize begin = MAX(next, inode->ra_end);
+    usize limit = MIN(next + inode->ra_window, num_blocks);
+    if (begin >= limit)
+        return;
+
+    usize block_nos[INODE_READAHEAD_MAX];
+    usize count = 0;
+    for (usize i = begin; i < limit; i++) {
+        bool modified = false;
+        block_nos[count++] = inode_map(NULL, inode, i * BLOCK_SIZE, &modified);
+        assert(!modified);
+    }
+
+    cache->prefetch(block_nos, count);
+    inode->ra_end = limit;
+}
+
 // see `inode.h`.
 static usize inode_read(Inode *inode, u8 *dest, usize offset, usize count) {
     // printf("> in inode_read\n");
@@ -375,8 +837,18 @@ static usize inode_read(Inode *inode, u8 *dest, usize offset, usize count) {
     assert(offset <= end);
 
     // printf("start inode_read\n");
+    if (count > 0)
+        inode_readahead(inode, offset, end);
+
     usize step = 0;
     for (usize begin = offset; begin < end; begin += step, dest += step) {
+        // 延迟分配的数据直接从内存中读取
+        if (inode->delay_data != NULL && begin >= inode->delay_begin * BLOCK_SIZE) {
+            step = end - begin;
+            memmove(dest, inode->delay_data + (begin - inode->delay_begin * BLOCK_SIZE), step);
+            continue;
+        }
+
         bool modified = false;
         usize block_no = inode_map(NULL, inode, begin, &modified);
         assert(!modified);
@@ -391,6 +863,69 @@ static usize inode_read(Inode *inode, u8 *dest, usize offset, usize count) {
     return count;
 }
 
+// see `inode.h`.
+static void inode_flush(OpContext *ctx, Inode *inode) {
+    u8 *data = inode->delay_data;
+    if (data == NULL)
+        return;
+
+    usize first = inode->delay_begin;
+    usize last = (inode->entry.num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    inode->delay_data = NULL;
+
+    // 此时已知全部延迟数据的长度，尽量将它们分配在一个连续区间中
+    bool modified = false;
+    if (first < last)
+        inode_alloc_extents(ctx, inode, first * BLOCK_SIZE, last * BLOCK_SIZE, &modified);
+    for (usize i = first; i < last; i++) {
+        usize block_no = inode_map(ctx, inode, i * BLOCK_SIZE, &modified);
+        // the whole block is overwritten, so its old content is not read.
+        Block *block = cache->acquire_zeroed(block_no);
+        memcpy(block->data, data + (i - first) * BLOCK_SIZE, BLOCK_SIZE);
+        cache->sync_data(ctx, block);
+        cache->release(block);
+    }
+
+    kfree(data);
+    inode_sync(ctx, inode, true);
+}
+
+// 将写入区间`[offset, end)`中位于已分配块之后的部分保存到延迟分配缓冲区中，
+// 缓冲区放不下时先调用`inode_flush`。
+// 返回仍需按常规方式写入的区间的结尾。
+//
+// NOTE: caller must hold the lock of `inode`.
+static usize inode_delay_write(OpContext *ctx, Inode *inode, u8 *src, usize offset, usize end) {
+    if (INODE_DELAY_MAX_BLOCKS == 0)
+        return end;
+
+    // 第一个尚未分配块的逻辑块，文件中不存在空洞，因此其后的块均未分配
+    usize first = (inode->entry.num_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (inode->delay_data != NULL)
+        first = inode->delay_begin;
+
+    usize begin = MAX(offset, first * BLOCK_SIZE);
+    if (begin >= end)
+        return end;
+
+    if (end > (first + INODE_DELAY_MAX_BLOCKS) * BLOCK_SIZE) {
+        inode_flush(ctx, inode);
+        return end;
+    }
+
+    if (inode->delay_data == NULL) {
+        inode->delay_data = kalloc();
+        if (inode->delay_data == NULL)
+            return end;
+        memset(inode->delay_data, 0, INODE_DELAY_MAX_BLOCKS * BLOCK_SIZE);
+        inode->delay_begin = first;
+        inode->delay_pass = __atomic_load_n(&flush_pass, __ATOMIC_ACQUIRE);
+    }
+
+    memmove(inode->delay_data + (begin - first * BLOCK_SIZE), src + (begin - offset), end - begin);
+    return begin;
+}
+
 // see `inode.h`.
 static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset, usize count) {
     InodeEntry *entry = &inode->entry;
@@ -406,21 +941,33 @@ static usize inode_write(OpContext *ctx, Inode *inode, u8 *src, usize offset, us
 
     usize step = 0;
     bool modified = false;
-    for (usize begin = offset; begin < end; begin += step, src += step) {
+    usize size = disk_size(inode);
+
+    // 文件尾部尚未分配块的数据只写入内存，`[offset, split)`按常规方式写入
+    usize split = end;
+    if (entry->type == INODE_REGULAR)
+        split = inode_delay_write(ctx, inode, src, offset, end);
+
+    if (entry->type == INODE_REGULAR && offset < split && (split - 1) / BLOCK_SIZE > offset / BLOCK_SIZE)
+        inode_alloc_extents(ctx, inode, offset, split, &modified);
+    for (usize begin = offset; begin < split; begin += step, src += step) {
         usize block_no = inode_map(ctx, inode, begin, &modified);
         Block *block = cache->acquire(block_no);
         usize index = begin % BLOCK_SIZE;
         step = MIN(end - begin, BLOCK_SIZE - index);
         memmove(block->data + index, src, step);
-        cache->sync(ctx, block);
+        // contents of regular files are written in place, and only metadata
+        // goes through log.
+        if (entry->type == INODE_REGULAR)
+            cache->sync_data(ctx, block);
+        else
+            cache->sync(ctx, block);
         cache->release(block);
     }
 
-    if (end > entry->num_bytes) {
+    if (end > entry->num_bytes)
         entry->num_bytes = (u32)end;
-        modified = true;
-    }
-    if (modified)
+    if (modified || disk_size(inode) != size)
         inode_sync(ctx, inode, true);
 
     // printf("inode_write to inode %u, offset %u, size %d \n", inode->inode_no, offset, count);
@@ -433,16 +980,30 @@ static usize inode_lookup(Inode *inode, const char *name, usize *index) {
     // printf("inode %u, name %s, inode_type %u\n", inode->inode_no, name, inode->entry.type);
     assert(entry->type == INODE_DIRECTORY);
 
-    DirEntry dentry;
-    for (usize offset = 0; offset < entry->num_bytes; offset += sizeof(dentry)) {
-        inode_read(inode, (u8 *)&dentry, offset, sizeof(dentry));
-        if (dentry.inode_no != 0 && strncmp(name, dentry.name, FILE_NAME_MAX_LENGTH) == 0) {
-            if (index != NULL)
-                *index = offset / sizeof(dentry);
-            return dentry.inode_no;
+    usize inode_no, i;
+    if (dcache_lookup(inode->inode_no, name, &inode_no, &i)) {
+        if (inode_no != 0 && index != NULL)
+            *index = i;
+        return inode_no;
+    }
+
+    // read directory entries in batches rather than one at a time.
+    DirEntry dentries[16];
+    for (usize offset = 0; offset < entry->num_bytes; offset += sizeof(dentries)) {
+        usize count = inode_read(inode, (u8 *)dentries, offset, sizeof(dentries)) / sizeof(DirEntry);
+        for (i = 0; i < count; i++) {
+            DirEntry *dentry = &dentries[i];
+            if (dentry->inode_no != 0 && strncmp(name, dentry->name, FILE_NAME_MAX_LENGTH) == 0) {
+                usize j = offset / sizeof(DirEntry) + i;
+                dcache_insert(inode->inode_no, name, dentry->inode_no, j);
+                if (index != NULL)
+                    *index = j;
+                return dentry->inode_no;
+            }
         }
     }
 
+    dcache_insert(inode->inode_no, name, 0, 0);
     return 0;
 }
 
@@ -479,6 +1040,7 @@ static usize inode_insert(OpContext *ctx, Inode *inode, const char *name, usize
     dentry.inode_no = (u16)inode_no;
     strncpy(dentry.name, name, FILE_NAME_MAX_LENGTH);
     inode_write(ctx, inode, (u8 *)&dentry, offset, sizeof(dentry));
+    dcache_insert(inode->inode_no, name, inode_no, offset / sizeof(dentry));
     return offset / sizeof(dentry);
 }
 
@@ -492,6 +1054,15 @@ static void inode_remove(OpContext *ctx, Inode *inode, usize index) {
     if (offset >= entry->num_bytes)
         return;
 
+    // the removed name becomes a negative entry in the dentry cache.
+    inode_read(inode, (u8 *)&dentry, offset, sizeof(dentry));
+    if (dentry.inode_no != 0) {
+        char name[FILE_NAME_MAX_LENGTH + 1];
+        strncpy(name, dentry.name, FILE_NAME_MAX_LENGTH);
+        name[FILE_NAME_MAX_LENGTH] = '\0';
+        dcache_insert(inode->inode_no, name, 0, 0);
+    }
+
     memset(&dentry, 0, sizeof(dentry));
     inode_write(ctx, inode, (u8 *)&dentry, offset, sizeof(dentry));
 }
@@ -552,9 +1123,7 @@ static Inode *namex(const char *path, int nameiparent, char *name, OpContext *ct
         inodes.lock(ip);
         if (ip->entry.type != INODE_DIRECTORY) {
             inodes.unlock(ip);
-            bcache.begin_op(ctx);
             inodes.put(ctx, ip);
-            bcache.end_op(ctx);
             return 0;
         }
         if (nameiparent && *path == '\0') {
@@ -566,20 +1135,19 @@ static Inode *namex(const char *path, int nameiparent, char *name, OpContext *ct
             inodes.unlock(ip);
             return ip;
         }
-        if (inodes.lookup(ip, name, 0) == 0) {
+        usize inode_no = inodes.lookup(ip, name, 0);
+        if (inode_no == 0) {
             inodes.unlock(ip);
             inodes.put(ctx, ip);
             return 0;
         }
-        next = inodes.get(inodes.lookup(ip, name, 0));
+        next = inodes.get(inode_no);
         inodes.unlock(ip);
         inodes.put(ctx, ip);
         ip = next;
     }
     if (nameiparent) {
-        bcache.begin_op(ctx);
         inodes.put(ctx, ip);
-        bcache.end_op(ctx);
         return 0;
     }
     return ip;
@@ -612,6 +1180,59 @@ void stati(Inode *ip, struct stat *st) {
         default: PANIC("unexpected stat type %d. ", ip->entry.type);
     }
 }
+// see `inode.h`.
+static void inode_flush_all() {
+    // 本趟开始之后才有延迟数据的inode留给下一趟，因此反复扫描桶也会结束
+    usize pass = __atomic_add_fetch(&flush_pass, 1, __ATOMIC_ACQ_REL);
+
+    for (usize i = 0; i < INODE_NUM_BUCKETS;) {
+        InodeBucket *bucket = &buckets[i];
+        acquire_spinlock(&bucket->lock);
+        Inode *inode = NULL;
+        for (ListNode *cur = bucket->head.next; cur != &bucket->head; cur = cur->next) {
+            Inode *inst = container_of(cur, Inode, node);
+            if (inst->rc.count > 0 && inst->delay_data != NULL && inst->delay_pass < pass) {
+                increment_rc(&inst->rc);
+                inode = inst;
+                break;
+            }
+        }
+        release_spinlock(&bucket->lock);
+
+        // move on once this bucket has nothing left to flush.
+        if (inode == NULL) {
+            i++;
+            continue;
+        }
+
+        OpContext ctx;
+        cache->begin_op(&ctx, INODE_FLUSH_LOG_BLOCKS);
+        inode_lock(inode);
+        inode_flush(&ctx, inode);
+        inode_unlock(inode);
+        inode_put(&ctx, inode);
+        cache->end_op(&ctx);
+    }
+
+    // 放弃`put`推迟的引用
+    while (true) {
+        Inode *inode = NULL;
+        acquire_spinlock(&lru_lock);
+        if (deferred.next != &deferred) {
+            inode = container_of(deferred.next, Inode, lru);
+            detach_from_list(&inode->lru);
+        }
+        release_spinlock(&lru_lock);
+        if (inode == NULL)
+            break;
+
+        OpContext ctx;
+        cache->begin_op(&ctx, inode_put_log_blocks(inode));
+        inode_put(&ctx, inode);
+        cache->end_op(&ctx);
+    }
+}
+
 InodeTree inodes = {
     .alloc = inode_alloc,
     .allocg = inode_alloc_group, // 修改为inode_alloc_group
@@ -622,8 +1243,11 @@ InodeTree inodes = {
     .clear = inode_clear,
     .share = inode_share,
     .put = inode_put,
+    .put_log_blocks = inode_put_log_blocks,
     .read = inode_read,
     .write = inode_write,
+    .flush = inode_flush,
+    .flush_all = inode_flush_all,
     .lookup = inode_lookup,
     .empty = inode_empty,
     .insert = inode_insert,
@@ -9,6 +9,58 @@
 
 #define ROOT_INODE_NO 1
 
+// read-ahead window of sequential reads, in blocks.
+// the window starts at `INODE_READAHEAD_MIN` and doubles on every sequential
+// read until `INODE_READAHEAD_MAX`. A non-sequential read resets it.
+#define INODE_READAHEAD_MIN 4
+#define INODE_READAHEAD_MAX 32
+
+// delayed allocation buffer of regular files, in blocks (one page).
+// data appended past the last allocated block is kept in memory, and blocks
+// are allocated for it in one extent when the buffer is flushed. Define it
+// as 0 to allocate blocks at write time.
+#define INODE_DELAY_MAX_BLOCKS 8
+
+// log entries to reserve by `begin_op` for `flush`. Each delayed block may be
+// allocated in a different block group and log its bitmap block, and so may
+// the indirect block. A data block written by `sync_data` takes a log entry
+// if another atomic operation has logged it. The indirect block and the inode
+// are logged too.
+#define INODE_FLUSH_LOG_BLOCKS                                                                     \
+    (INODE_DELAY_MAX_BLOCKS + MIN(INODE_DELAY_MAX_BLOCKS + 1, NGROUPS) + 2)
+
+// log entries to reserve for freeing an inode whose last link is dropped: the
+// bitmap blocks of its blocks in up to `NGROUPS` block groups, the inode, the
+// inode bitmap and the group descriptor table.
+#define INODE_FREE_LOG_BLOCKS (NGROUPS + 3)
+
+// log entries to reserve for `alloc`: the inode bitmap, the inode and the group
+// descriptor table.
+#define INODE_ALLOC_LOG_BLOCKS 3
+
+// log entries to reserve for `insert`: the directory block, the indirect block,
+// their bitmap blocks and the directory inode.
+#define INODE_INSERT_LOG_BLOCKS 5
+
+// log entries to reserve for `remove`: the directory block.
+#define INODE_REMOVE_LOG_BLOCKS 1
+
+// in-memory inodes are kept in a hash table of `INODE_NUM_BUCKETS` buckets
+// indexed by inode number. Each bucket has its own lock.
+#define INODE_NUM_BUCKETS 64
+
+// at most `INODE_CACHE_SIZE` unreferenced inodes are kept in memory with their
+// entries loaded, so getting them again needs no disk read. The least
+// recently used one is freed first, either when the limit is exceeded or
+// when a new in-memory inode cannot be allocated.
+#define INODE_CACHE_SIZE 64
+
+// the dentry cache remembers the results of the last `INODE_DCACHE_SIZE`
+// directory lookups, including names that are not found, in a hash table of
+// `INODE_DCACHE_NUM_BUCKETS` buckets. `insert` and `remove` keep it up to date.
+#define INODE_DCACHE_SIZE        128
+#define INODE_DCACHE_NUM_BUCKETS 64
+
 struct InodeTree;
 
 typedef struct {
@@ -18,11 +70,24 @@ typedef struct {
     SpinLock lock;
 
     RefCount rc;
-    ListNode node;
+    ListNode node;  // in the hash bucket of `inode_no`.
+    ListNode lru;   // in the LRU list of unreferenced inodes if `rc` is zero.
     usize inode_no;
 
     bool valid;        // is `entry` loaded?
     InodeEntry entry;  // real inode data on the disk.
+
+    // read-ahead states, also protected by `lock`.
+    usize ra_offset;  // where the next sequential read begins.
+    usize ra_window;  // current size of read-ahead window in blocks, 0 if not sequential.
+    usize ra_end;     // blocks before index `ra_end` have been read ahead.
+
+    // delayed allocation states, also protected by `lock`.
+    // blocks from index `delay_begin` to the end of file have no block on disk
+    // yet, and their data lives in `delay_data`.
+    u8 *delay_data;     // NULL if nothing is delayed.
+    usize delay_begin;  // index of the first delayed block.
+    usize delay_pass;   // `delay_data` was allocated during this pass of `flush_all`.
 } Inode;
 
 typedef struct InodeTree {
@@ -70,10 +135,18 @@ typedef struct InodeTree {
     // decrement reference count of `inode` by one.
     // if reference count drops to zero and there's no file or directory linked to this
     // inode, `put` is in charge of freeing this inode both in memory and on disk.
+    // if `ctx` has less log entries left than flushing or freeing `inode` needs,
+    // the last reference is kept until `flush_all`.
     //
     // NOTE: caller must NOT hold the lock of `inode`.
     void (*put)(OpContext *ctx, Inode *inode);
 
+    // return the number of log entries that `put` needs if it drops the last
+    // reference of `inode`, i.e. `INODE_FREE_LOG_BLOCKS` if no file or directory
+    // is linked to it, `INODE_FLUSH_LOG_BLOCKS` if it has delayed data, or 0.
+    // without the lock of `inode` it is only a hint for `begin_op`.
+    usize (*put_log_blocks)(Inode *inode);
+
     // read exactly `count` bytes from `inode`, beginning at `offset`, to `dest`.
     //
     // NOTE: caller must hold the lock of `inode`.
@@ -84,6 +157,20 @@ typedef struct InodeTree {
     // NOTE: caller must hold the lock of `inode`.
     usize (*write)(OpContext *ctx, Inode *inode, u8 *src, usize offset, usize count);
 
+    // allocate blocks for delayed data of `inode` and write them.
+    // data written to regular files may stay in memory until `flush`, which
+    // is also called when the last reference to `inode` is put.
+    //
+    // NOTE: caller must hold the lock of `inode`.
+    void (*flush)(OpContext *ctx, Inode *inode);
+
+    // `flush` every in-memory inode with delayed data, each in its own
+    // atomic operation. References kept by `put` are then put.
+    // data delayed after `flush_all` begins is left for the next call.
+    //
+    // NOTE: the caller should not be inside an atomic operation.
+    void (*flush_all)();
+
     // for directory inode only.
     //
     // look up `name` in directory `inode`.
@@ -1,4 +1,5 @@
 extern "C" {
+#include <common/checksum.h>
 #include <fs/cache.h>
 }
 
@@ -123,27 +124,112 @@ void test_reuse() {
 }
 
 void test_lru() {
-    std::mt19937 gen(0xdeadbeef);
-
+    constexpr usize capacity = 256;
     usize cold_size = 1000;
-    usize hot_size = EVICTION_THRESHOLD * 0.8;
+    usize hot_size = capacity * 0.8;
     initialize(1, cold_size + hot_size);
-    for (int i = 0; i < 1000; i++) {
-        bool hot = (gen() % 100) <= 90;
-        usize bno = hot ? (gen() % hot_size) : (hot_size + gen() % cold_size);
 
-        auto *b = bcache.acquire(bno);
-        auto *d = mock.inspect(bno);
-        assert_eq(b->data[123], d[123]);
+    for (auto policy : {BCACHE_POLICY_CLOCK, BCACHE_POLICY_ARC}) {
+        std::mt19937 gen(0xdeadbeef);
+        bcache.configure(capacity, policy);
+        mock.read_count = 0;
+        mock.write_count = 0;
+        for (int i = 0; i < 1000; i++) {
+            bool hot = (gen() % 100) <= 90;
+            usize bno = hot ? (gen() % hot_size) : (hot_size + gen() % cold_size);
+
+            auto *b = bcache.acquire(bno);
+            auto *d = mock.inspect(bno);
+            assert_eq(b->data[123], d[123]);
+            bcache.release(b);
+        }
+
+        printf("(debug) policy = %d, #cached = %zu, #read = %zu\n",
+               policy,
+               bcache.get_num_cached_blocks(),
+               mock.read_count.load());
+        assert_true(bcache.get_num_cached_blocks() <= capacity);
+        assert_true(mock.read_count < 400);
+        assert_true(mock.write_count < 5);
+    }
+}
+
+void test_scan_resistance() {
+    constexpr usize capacity = 256;
+    constexpr usize hot_size = capacity / 4;
+    constexpr usize cold_size = capacity * 4;
+    initialize(1, hot_size + cold_size);
+    bcache.configure(capacity, BCACHE_POLICY_ARC);
+
+    // touch hot blocks twice so that ARC knows they are frequently used.
+    for (usize round = 0; round < 2; round++) {
+        for (usize i = 0; i < hot_size; i++) {
+            bcache.release(bcache.acquire(i));
+        }
+    }
+
+    // a long sequential scan should not flush hot blocks out.
+    for (usize i = 0; i < cold_size; i++) {
+        bcache.release(bcache.acquire(hot_size + i));
+    }
+
+    usize count = mock.read_count;
+    for (usize i = 0; i < hot_size; i++) {
+        auto *b = bcache.acquire(i);
+        assert_eq(b->data[123], mock.inspect(i)[123]);
         bcache.release(b);
     }
 
-    printf("(debug) #cached = %zu, #read = %zu\n",
+    printf("(debug) #cached = %zu, #reread = %zu\n",
            bcache.get_num_cached_blocks(),
-           mock.read_count.load());
-    assert_true(bcache.get_num_cached_blocks() <= EVICTION_THRESHOLD);
-    assert_true(mock.read_count < 233);
-    assert_true(mock.write_count < 5);
+           mock.read_count - count);
+    assert_true(bcache.get_num_cached_blocks() <= capacity);
+    assert_eq(mock.read_count, count);
+}
+
+void test_prefetch() {
+    initialize(1, 100);
+
+    usize block_nos[32];
+    for (usize i = 0; i < 32; i++) {
+        block_nos[i] = sblock.bg_start + 10 + i;
+    }
+    usize count = mock.read_count;
+    bcache.prefetch(block_nos, 16);
+    bcache.prefetch(block_nos, 32);
+    assert_eq(mock.read_count, count + 32);
+
+    for (usize i = 0; i < 32; i++) {
+        auto *b = bcache.acquire(block_nos[i]);
+        assert_eq(b->valid, true);
+        assert_eq(b->data[233], mock.inspect(block_nos[i])[233]);
+        bcache.release(b);
+    }
+    assert_eq(mock.read_count, count + 32);
+}
+
+void test_hash_collision() {
+    // all these blocks fall into the same bucket of the same shard.
+    constexpr usize stride = BCACHE_NUM_SHARDS * BCACHE_NUM_BUCKETS;
+    constexpr usize num_blocks = BCACHE_CAPACITY / BCACHE_NUM_SHARDS / 2;
+    initialize(1, stride * num_blocks);
+
+    constexpr usize num_rounds = 100;
+    for (usize round = 0; round < num_rounds; round++) {
+        std::vector<Block *> p;
+        for (usize i = 0; i < num_blocks; i++) {
+            usize bno = stride * i + 7;
+            p.push_back(bcache.acquire(bno));
+            assert_eq(p[i]->block_no, bno);
+            assert_eq(p[i]->data[233], mock.inspect(bno)[233]);
+        }
+        for (auto *b : p) {
+            bcache.release(b);
+        }
+    }
+
+    assert_eq(bcache.get_num_cached_blocks(), num_blocks);
+    assert_true(mock.read_count < 2 * num_blocks);
 }
 
 // targets: `begin_op`, `end_op`, `sync`.
@@ -152,10 +238,10 @@ void test_atomic_op() {
     initialize(32, 64);
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
     bcache.end_op(&ctx);
 
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
     usize t = sblock.num_blocks - 1;
     auto *b = bcache.acquire(t);
@@ -172,9 +258,10 @@ void test_atomic_op() {
 
     assert_eq(d[128], v);
     bcache.end_op(&ctx);
+    bcache.flush();
     assert_eq(d[128], ~v);
 
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
     auto *b1 = bcache.acquire(t - 1);
     auto *b2 = bcache.acquire(t - 2);
@@ -198,6 +285,7 @@ void test_atomic_op() {
     assert_eq(d1[500], v1);
     assert_eq(d2[10], v2);
     bcache.end_op(&ctx);
+    bcache.flush();
     assert_eq(d1[500], ~v1);
     assert_eq(d2[10], ~v2);
 }
@@ -206,7 +294,7 @@ void test_overflow() {
     initialize(100, 100);
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
     usize t = sblock.num_blocks - 1;
     for (usize i = 0; i < OP_MAX_NUM_BLOCKS; i++) {
@@ -226,6 +314,42 @@ void test_overflow() {
     assert_eq(panicked, true);
 }
 
+void test_reservation() {
+    initialize(20, 100);
+
+    usize t = sblock.num_blocks - 1;
+    usize space = bcache.get_free_log_space();
+    assert_true(space >= 2);
+
+    OpContext small, large;
+    bcache.begin_op(&small, 1);
+    bcache.begin_op(&large, space - 1);
+    assert_eq(bcache.get_free_log_space(), 0);
+
+    auto *b = bcache.acquire(t);
+    b->data[0] = 0x12;
+    bcache.sync(&small, b);
+    bcache.release(b);
+    bcache.end_op(&small);
+
+    for (usize i = 1; i < space; i++) {
+        b = bcache.acquire(t - i);
+        b->data[0] = 0x34;
+        bcache.sync(&large, b);
+        bcache.release(b);
+    }
+    bcache.end_op(&large);
+
+    // the log is full, so next atomic operation triggers a group commit.
+    OpContext ctx;
+    bcache.begin_op(&ctx, 1);
+    assert_eq(mock.inspect(t)[0], 0x12);
+    for (usize i = 1; i < space; i++) {
+        assert_eq(mock.inspect(t - i)[0], 0x34);
+    }
+    bcache.end_op(&ctx);
+}
+
 void test_resident() {
     // NOTE: this test may be a little controversial.
     // the main ideas are:
@@ -253,7 +377,7 @@ void test_resident() {
 
     for (usize round = 0; round < num_rounds; round++) {
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
         for (usize block_no : blocks) {
             auto *b = bcache.acquire(block_no);
@@ -275,7 +399,7 @@ void test_local_absorption() {
     initialize(100, 100);
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
     usize t = sblock.num_blocks - 1;
     for (usize i = 0; i < num_rounds; i++) {
         for (usize j = 0; j < OP_MAX_NUM_BLOCKS; j++) {
@@ -286,6 +410,7 @@ void test_local_absorption() {
         }
     }
     bcache.end_op(&ctx);
+    bcache.flush();
 
     assert_true(mock.read_count < OP_MAX_NUM_BLOCKS * 5);
     assert_true(mock.write_count < OP_MAX_NUM_BLOCKS * 5);
@@ -303,7 +428,7 @@ void test_global_absorption() {
     usize t = sblock.num_blocks - 1;
 
     OpContext out;
-    bcache.begin_op(&out);
+    bcache.begin_op(&out, OP_MAX_NUM_BLOCKS);
 
     for (usize i = 0; i < OP_MAX_NUM_BLOCKS; i++) {
         auto *b = bcache.acquire(t - i);
@@ -318,7 +443,7 @@ void test_global_absorption() {
     workers.reserve(num_workers);
 
     for (usize i = 0; i < num_workers; i++) {
-        bcache.begin_op(&ctx[i]);
+        bcache.begin_op(&ctx[i], OP_MAX_NUM_BLOCKS);
         for (usize j = 0; j < op_size; j++) {
             auto *b = bcache.acquire(t - j);
             b->data[0] = 0xdd;
@@ -333,6 +458,7 @@ void test_global_absorption() {
     for (auto &worker : workers) {
         worker.join();
     }
+    bcache.flush();
 
     for (usize i = 0; i < op_size; i++) {
         auto *b = mock.inspect(t - i);
@@ -345,22 +471,195 @@ void test_global_absorption() {
     }
 }
 
-// target: replay at initialization.
+void test_group_commit() {
+    constexpr usize num_rounds = 5;
 
-void test_replay() {
-    initialize_mock(50, 1000);
+    initialize(100, 100);
+
+    usize t = sblock.num_blocks - 1;
+    auto *d = mock.inspect(t);
+    u8 v = d[0];
+
+    for (usize i = 0; i < num_rounds; i++) {
+        OpContext ctx;
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+        auto *b = bcache.acquire(t);
+        b->data[0] = static_cast<u8>(v + i + 1);
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+        bcache.end_op(&ctx);
+    }
+
+    // committed atomic operations are not checkpointed one by one.
+    assert_eq(d[0], v);
+
+    usize write_count = mock.write_count;
+    bcache.flush();
+    assert_eq(d[0], static_cast<u8>(v + num_rounds));
+
+    // one log block, one home block and two header writes.
+    assert_eq(mock.write_count - write_count, 4);
+}
+
+void test_commit_interval() {
+    initialize(100, 100);
+
+    usize t = sblock.num_blocks - 1;
+    auto *d = mock.inspect(t);
+    u8 v = d[0];
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    auto *b = bcache.acquire(t);
+    b->data[0] = static_cast<u8>(v + 1);
+    bcache.sync(&ctx, b);
+    bcache.release(b);
+    bcache.end_op(&ctx);
+
+    // not due yet.
+    bcache.commit_if_due();
+    assert_eq(d[0], v);
+
+    // no more atomic operations end, but the flusher still commits them.
+    std::this_thread::sleep_for(std::chrono::milliseconds(BCACHE_COMMIT_INTERVAL));
+    bcache.commit_if_due();
+    assert_eq(d[0], static_cast<u8>(v + 1));
+}
+
+void test_sorted_checkpoint() {
+    initialize(100, 100);
+
+    usize t = sblock.num_blocks - 1;
+    constexpr usize offsets[] = {3, 9, 0, 5, 1, 7};
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    for (usize offset : offsets) {
+        auto *b = bcache.acquire(t - offset);
+        b->data[0] = 0x77;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+    }
+    bcache.end_op(&ctx);
+
+    std::vector<usize> written;
+    mock.on_write = [&](usize block_no, auto) {
+        if (block_no > t - 10)
+            written.push_back(block_no);
+    };
+    bcache.flush();
+
+    assert_eq(written.size(), std::size(offsets));
+    assert_true(std::is_sorted(written.begin(), written.end()));
+}
+
+void test_nonblocking_checkpoint() {
+    initialize(100, 100);
+
+    usize t = sblock.num_blocks - 1;
+    auto write = [&](usize block_no, u8 v) {
+        OpContext ctx;
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+        auto *b = bcache.acquire(block_no);
+        b->data[0] = v;
+        bcache.sync(&ctx, b);
+        bcache.release(b);
+        bcache.end_op(&ctx);
+    };
 
+    write(t, 0x11);
+
+    // run another atomic operation while the group is being written to disk.
+    bool nested = false;
+    mock.on_write = [&](usize block_no, auto) {
+        if (block_no == t && !nested) {
+            nested = true;
+            write(t - 1, 0x22);
+        }
+    };
+
+    bcache.flush();
+    assert_eq(nested, true);
+    assert_eq(mock.inspect(t)[0], 0x11);
+
+    mock.on_write = nullptr;
+    bcache.flush();
+    assert_eq(mock.inspect(t - 1)[0], 0x22);
+}
+
+void test_sync_data() {
+    initialize(100, 100);
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    usize block_no = bcache.alloc(&ctx);
+    auto *b = bcache.acquire(block_no);
+    b->data[0] = 0x5a;
+    bcache.sync_data(&ctx, b);
+    bcache.release(b);
+
+    // data is written in place before the atomic operation commits.
+    assert_eq(mock.inspect(block_no)[0], 0x5a);
+
+    // only the bitmap block and the group descriptor go through log.
+    usize write_count = mock.write_count;
+    bcache.end_op(&ctx);
+    bcache.flush();
+    assert_eq(mock.write_count - write_count, 6);
+
+    // a block with pending log entries is still logged.
+    usize t = sblock.num_blocks - 1;
+    auto *d = mock.inspect(t);
+    u8 v = d[0];
+
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    b = bcache.acquire(t);
+    b->data[0] = static_cast<u8>(v + 1);
+    bcache.sync(&ctx, b);
+    bcache.release(b);
+    bcache.end_op(&ctx);
+
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    b = bcache.acquire(t);
+    b->data[0] = static_cast<u8>(v + 2);
+    bcache.sync_data(&ctx, b);
+    bcache.release(b);
+    assert_eq(d[0], v);
+    bcache.end_op(&ctx);
+
+    bcache.flush();
+    assert_eq(d[0], static_cast<u8>(v + 2));
+}
+
+// target: replay at initialization.
+
+// write a commit record of 5 blocks into log.
+static void prepare_log() {
     auto *header = mock.inspect_log_header();
     header->num_blocks = 5;
     for (usize i = 0; i < 5; i++) {
         usize v = 500 + i;
-        header->block_no[i] = v;
+        header->block_no[i] = static_cast<u32>(v);
         auto *b = mock.inspect_log(i);
         for (usize j = 0; j < BLOCK_SIZE; j++) {
             b[j] = v & 0xff;
         }
     }
 
+    u32 sum = checksum(CHECKSUM_INIT, &header->num_blocks, sizeof(header->num_blocks));
+    sum = checksum(sum, header->block_no, sizeof(u32) * header->num_blocks);
+    for (usize i = 0; i < 5; i++) {
+        sum = checksum(sum, mock.inspect_log(i), BLOCK_SIZE);
+    }
+    header->checksum = sum;
+}
+
+void test_replay() {
+    initialize_mock(50, 1000);
+
+    auto *header = mock.inspect_log_header();
+    prepare_log();
+
     init_bcache(&sblock, &device);
 
     assert_eq(header->num_blocks, 0);
@@ -373,6 +672,24 @@ void test_replay() {
     }
 }
 
+void test_torn_log() {
+    initialize_mock(50, 1000);
+
+    auto *header = mock.inspect_log_header();
+    prepare_log();
+    mock.inspect_log(3)[100] ^= 0xff;
+
+    std::vector<u8> old(mock.inspect(500), mock.inspect(500) + BLOCK_SIZE);
+
+    init_bcache(&sblock, &device);
+
+    assert_eq(header->num_blocks, 0);
+    auto *b = mock.inspect(500);
+    for (usize j = 0; j < BLOCK_SIZE; j++) {
+        assert_eq(b[j], old[j]);
+    }
+}
+
 // targets: `alloc`, `free`.
 
 void test_alloc() {
@@ -382,7 +699,7 @@ void test_alloc() {
     bno.reserve(100);
     for (int i = 0; i < 100; i++) {
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
         bno.push_back(bcache.alloc(&ctx));
         assert_ne(bno[i], 0);
@@ -395,6 +712,7 @@ void test_alloc() {
         bcache.release(b);
 
         bcache.end_op(&ctx);
+        bcache.flush();
         auto *d = mock.inspect(bno[i]);
         for (usize j = 0; j < BLOCK_SIZE; j++) {
             assert_eq(d[j], 0);
@@ -406,7 +724,7 @@ void test_alloc() {
     assert_eq(count, bno.size());
 
     OpContext ctx;
-    bcache.begin_op(&ctx);
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
     bool panicked = false;
     try {
@@ -417,6 +735,122 @@ void test_alloc() {
     assert_eq(panicked, true);
 }
 
+void test_alloc_goal() {
+    initialize(100, 100);
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    usize b0 = bcache.alloc(&ctx);
+    usize b1 = bcache.alloc(&ctx);
+    assert_eq(b1, b0 + 1);
+
+    // start from the goal if it is free.
+    usize b2 = bcache.allocg(&ctx, 0, b0 + 50);
+    assert_eq(b2, b0 + 50);
+
+    // otherwise resume from where the last allocation stopped.
+    usize b3 = bcache.allocg(&ctx, 0, 0);
+    assert_eq(b3, b0 + 51);
+    bcache.free(&ctx, b1);
+    assert_eq(bcache.alloc(&ctx), b0 + 52);
+
+    // a used goal falls back to the next free block after it. So does a goal
+    // that is freed but not checkpointed yet.
+    assert_eq(bcache.allocg(&ctx, 0, b1), b0 + 2);
+    assert_eq(bcache.allocg(&ctx, 0, b0), b0 + 3);
+    bcache.end_op(&ctx);
+
+    bcache.flush();
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    assert_eq(bcache.allocg(&ctx, 0, b1), b1);
+    bcache.end_op(&ctx);
+}
+
+void test_alloc_extent() {
+    initialize(100, 100);
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    usize n = 0;
+    usize b0 = bcache.alloc_extent(&ctx, 0, 1, 10, &n);
+    assert_ne(b0, 0);
+    assert_eq(n, 10);
+    // only the bitmap block is logged. The group descriptor table joins the
+    // log at group commit.
+    assert_eq(ctx.num_blocks, 1);
+    for (usize i = 0; i < n; i++) {
+        auto *b = bcache.acquire(b0 + i);
+        for (usize j = 0; j < BLOCK_SIZE; j++) {
+            assert_eq(b->data[j], 0);
+        }
+        bcache.release(b);
+    }
+    assert_eq(bcache.alloc(&ctx), b0 + 10);
+
+    // a freed block is not reused before its free is checkpointed.
+    bcache.free(&ctx, b0 + 5);
+    usize b1 = bcache.alloc_extent(&ctx, b0, 1, 5, &n);
+    assert_eq(b1, b0 + 11);
+    assert_eq(n, 5);
+    bcache.end_op(&ctx);
+    bcache.flush();
+
+    // then the hole is reused if it is long enough.
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    usize b2 = bcache.alloc_extent(&ctx, b0, 2, 5, &n);
+    assert_eq(b2, b0 + 16);
+    assert_eq(n, 5);
+    assert_eq(bcache.alloc_extent(&ctx, b0, 1, 5, &n), b0 + 5);
+    assert_eq(n, 1);
+
+    assert_eq(bcache.alloc_extent(&ctx, b0, 200, 200, &n), 0);
+    bcache.end_op(&ctx);
+}
+
+void test_group_desc() {
+    initialize(100, 100);
+
+    std::vector<usize> bno;
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    for (usize i = 0; i < 3; i++) {
+        bno.push_back(bcache.alloc(&ctx));
+    }
+    bcache.free(&ctx, bno[1]);
+    bcache.end_op(&ctx);
+
+    auto *desc = reinterpret_cast<GroupDesc *>(mock.inspect(sblock.gdt_start));
+    assert_eq(desc->num_free_blocks, 100);
+
+    // free block counts are kept in memory and written at group commit.
+    bcache.flush();
+    assert_eq(desc->num_free_blocks, 98);
+}
+
+void test_acquire_zeroed() {
+    initialize(100, 100);
+
+    usize t = sblock.num_blocks - 1;
+    usize read_count = mock.read_count;
+    auto *b = bcache.acquire_zeroed(t);
+    assert_eq(b->valid, true);
+    for (usize j = 0; j < BLOCK_SIZE; j++) {
+        assert_eq(b->data[j], 0);
+    }
+    bcache.release(b);
+    assert_eq(mock.read_count, read_count);
+
+    // newly allocated blocks are not read from disk.
+    std::vector<usize> read;
+    mock.on_read = [&](usize block_no, auto) { read.push_back(block_no); };
+
+    OpContext ctx;
+    bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
+    usize block_no = bcache.alloc(&ctx);
+    bcache.end_op(&ctx);
+    assert_true(std::find(read.begin(), read.end(), block_no) == read.end());
+}
+
 void test_alloc_free() {
     constexpr usize num_rounds = 5;
     constexpr usize num_data_blocks = 1000;
@@ -427,7 +861,7 @@ void test_alloc_free() {
         std::vector<usize> bno;
         for (usize i = 0; i < num_data_blocks; i++) {
             OpContext ctx;
-            bcache.begin_op(&ctx);
+            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
             bno.push_back(bcache.alloc(&ctx));
             bcache.end_op(&ctx);
         }
@@ -441,13 +875,14 @@ void test_alloc_free() {
             assert_ne(no, 0);
 
             OpContext ctx;
-            bcache.begin_op(&ctx);
+            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
             bcache.free(&ctx, no);
             bcache.end_op(&ctx);
         }
+        bcache.flush();
 
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
         usize no = bcache.alloc(&ctx);
         assert_ne(no, 0);
         for (usize i = 1; i < num_data_blocks; i += 2) {
@@ -457,10 +892,13 @@ void test_alloc_free() {
         bcache.end_op(&ctx);
 
         for (usize i = 1; i < num_data_blocks; i += 2) {
-            bcache.begin_op(&ctx);
+            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
             bcache.free(&ctx, bno[i]);
             bcache.end_op(&ctx);
         }
+
+        // freed blocks can be allocated again once they are checkpointed.
+        bcache.flush();
     }
 }
 
@@ -553,7 +991,7 @@ void test_sync() {
     {
         std::unique_lock lock(mtx);
         for (int j = 0; j < num_rounds; j++) {
-            bcache.begin_op(&ctx);
+            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
             round = j;
             count = 0;
             cv.notify_all();
@@ -563,6 +1001,7 @@ void test_sync() {
             if (j > 0)
                 check(j - 1);
             bcache.end_op(&ctx);
+            bcache.flush();
             check(j);
         }
     }
@@ -582,7 +1021,7 @@ void test_alloc() {
             usize t = 250 * i;
             for (usize j = 0; j < 250; j++) {
                 OpContext ctx;
-                bcache.begin_op(&ctx);
+                bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
                 bno[t + j] = bcache.alloc(&ctx);
                 bcache.end_op(&ctx);
             }
@@ -610,7 +1049,7 @@ void test_simple_crash() {
         initialize(100, 100);
 
         OpContext ctx;
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
         auto *b = bcache.acquire(150);
         b->data[200] = 0x19;
         b->data[201] = 0x26;
@@ -619,8 +1058,9 @@ void test_simple_crash() {
         bcache.sync(&ctx, b);
         bcache.release(b);
         bcache.end_op(&ctx);
+        bcache.flush();
 
-        bcache.begin_op(&ctx);
+        bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
         b = bcache.acquire(150);
         b->data[200] = 0xcc;
         b->data[201] = 0xcc;
@@ -684,7 +1124,7 @@ void test_parallel(usize num_rounds, usize num_workers, usize delay_ms, usize lo
                         u64 v = 0;
                         while (true) {
                             OpContext ctx;
-                            bcache.begin_op(&ctx);
+                            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
                             for (usize j = 0; j < OP_MAX_NUM_BLOCKS; j++) {
                                 auto *b = bcache.acquire(t + j);
                                 for (usize k = 0; k < BLOCK_SIZE; k += sizeof(u64)) {
@@ -711,7 +1151,10 @@ void test_parallel(usize num_rounds, usize num_workers, usize delay_ms, usize lo
 
             aha.join();
             mock.dump("sd.img");
-            exit(0);
+
+            // detached workers may be still running, so do not destruct
+            // global objects under them.
+            _exit(0);
         } else {
             wait_process(child);
             initialize_mock(log_size, num_data_blocks, "sd.img");
@@ -774,7 +1217,7 @@ void test_banker() {
             bno.reserve(num_accounts);
             for (usize i = 0; i < num_accounts; i++) {
                 OpContext ctx;
-                bcache.begin_op(&ctx);
+                bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
                 bno.push_back(bcache.alloc(&ctx));
                 auto *b = bcache.acquire(bno.back());
                 i64 *p = reinterpret_cast<i64 *>(b->data);
@@ -783,6 +1226,7 @@ void test_banker() {
                 bcache.release(b);
                 bcache.end_op(&ctx);
             }
+            bcache.flush();
 
             std::random_device rd;
             std::atomic<usize> count = 0;
@@ -799,7 +1243,7 @@ void test_banker() {
                                 k = (k + 1) % num_accounts;
 
                             OpContext ctx;
-                            bcache.begin_op(&ctx);
+                            bcache.begin_op(&ctx, OP_MAX_NUM_BLOCKS);
 
                             Block *bj, *bk;
                             if (j < k) {
@@ -841,7 +1285,10 @@ void test_banker() {
             fflush(stdout);
 
             mock.dump("sd.img");
-            exit(0);
+
+            // detached workers may be still running, so do not destruct
+            // global objects under them.
+            _exit(0);
         } else {
             wait_process(child);
             initialize_mock(log_size, num_accounts, "sd.img");
@@ -882,13 +1329,27 @@ int main() {
         {"loop_read", basic::test_loop_read},
         {"reuse", basic::test_reuse},
         {"lru", basic::test_lru},
+        {"scan_resistance", basic::test_scan_resistance},
+        {"hash_collision", basic::test_hash_collision},
+        {"prefetch", basic::test_prefetch},
         {"atomic_op", basic::test_atomic_op},
         {"overflow", basic::test_overflow},
+        {"reservation", basic::test_reservation},
         {"resident", basic::test_resident},
         {"local_absorption", basic::test_local_absorption},
         {"global_absorption", basic::test_global_absorption},
+        {"group_commit", basic::test_group_commit},
+        {"commit_interval", basic::test_commit_interval},
+        {"sorted_checkpoint", basic::test_sorted_checkpoint},
+        {"nonblocking_checkpoint", basic::test_nonblocking_checkpoint},
+        {"sync_data", basic::test_sync_data},
         {"replay", basic::test_replay},
+        {"torn_log", basic::test_torn_log},
         {"alloc", basic::test_alloc},
+        {"alloc_goal", basic::test_alloc_goal},
+        {"alloc_extent", basic::test_alloc_extent},
+        {"group_desc", basic::test_group_desc},
+        {"acquire_zeroed", basic::test_acquire_zeroed},
         {"alloc_free", basic::test_alloc_free},
 
         {"concurrent_acquire", concurrent::test_acquire},
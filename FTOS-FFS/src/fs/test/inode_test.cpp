@@ -2,6 +2,9 @@ extern "C" {
 #include <fs/inode.h>
 }
 
+#include <atomic>
+#include <thread>
+
 #include "assert.hpp"
 #include "pause.hpp"
 #include "runner.hpp"
@@ -189,6 +192,7 @@ void test_small_file() {
     mock.begin_op(ctx);
     inodes.write(ctx, p, buf, 0, 1);
     assert_eq(mock.count_blocks(), 0);
+    inodes.flush(ctx, p);
     mock.end_op(ctx);
 
     auto *q = mock.inspect(ino);
@@ -245,6 +249,7 @@ void test_large_file() {
 
         mock.begin_op(ctx);
         inodes.write(ctx, p, buf + i, i, n);
+        inodes.flush(ctx, p);
         auto *q = mock.inspect(ino);
         assert_eq(q->num_bytes, i);
         mock.end_op(ctx);
@@ -279,6 +284,7 @@ void test_large_file() {
     inodes.lock(p);
     mock.begin_op(ctx);
     inodes.write(ctx, p, buf, 0, max_size);
+    inodes.flush(ctx, p);
     mock.end_op(ctx);
     inodes.unlock(p);
 
@@ -396,6 +402,401 @@ void test_dir() {
     }
 }
 
+void test_reuse() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+    assert_true(mock.inspect_ibitmap(ino));
+    assert_eq(mock.inspect_desc()->num_free_inodes, mock.num_inodes - 2);
+
+    auto *p = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    assert_true(mock.inspect_ibitmap(ino));
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_inodes(), 1);
+    assert_true(!mock.inspect_ibitmap(ino));
+    assert_eq(mock.inspect_desc()->num_free_inodes, mock.num_inodes - 1);
+    assert_eq(mock.inspect_desc()->num_dirs, 1);
+
+    // the freed number is the first free one, so it is handed out again.
+    mock.begin_op(ctx);
+    assert_eq(inodes.alloc(ctx, INODE_DIRECTORY), ino);
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_inodes(), 2);
+    assert_true(mock.inspect_ibitmap(ino));
+    assert_eq(mock.inspect(ino)->type, INODE_DIRECTORY);
+    assert_eq(mock.inspect_desc()->num_free_inodes, mock.num_inodes - 2);
+    assert_eq(mock.inspect_desc()->num_dirs, 2);
+}
+
+void test_create_unlink() {
+    constexpr usize num_workers = 4;
+    constexpr usize num_rounds = 200;
+
+    // a number must never be handed to two workers at the same time.
+    std::atomic<bool> used[mock.num_inodes + 1];
+    for (auto &flag : used) {
+        flag.store(false);
+    }
+
+    std::vector<std::thread> workers;
+    for (usize i = 0; i < num_workers; i++) {
+        workers.emplace_back([&] {
+            OpContext ctx;
+            for (usize j = 0; j < num_rounds; j++) {
+                mock.begin_op(&ctx);
+                usize ino = inodes.alloc(&ctx, INODE_REGULAR);
+                mock.end_op(&ctx);
+                assert_ne(ino, 0);
+                assert_true(!used[ino].exchange(true));
+
+                auto *p = inodes.get(ino);
+                inodes.lock(p);
+                assert_eq(p->entry.type, INODE_REGULAR);
+                assert_eq(p->entry.num_links, 0);
+                inodes.unlock(p);
+
+                used[ino].store(false);
+                mock.begin_op(&ctx);
+                inodes.put(&ctx, p);
+                mock.end_op(&ctx);
+            }
+        });
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    assert_eq(mock.count_inodes(), 1);
+    for (usize i = 2; i <= mock.num_inodes; i++) {
+        assert_true(!mock.inspect_ibitmap(i));
+    }
+    assert_eq(mock.inspect_desc()->num_free_inodes, mock.num_inodes - 1);
+}
+
+// allocate `n` regular files with one link each.
+static void alloc_linked(usize *ino, usize n) {
+    mock.begin_op(ctx);
+    for (usize i = 0; i < n; i++) {
+        ino[i] = inodes.alloc(ctx, INODE_REGULAR);
+        auto *p = inodes.get(ino[i]);
+        inodes.lock(p);
+        p->entry.num_links = 1;
+        p->entry.minor = static_cast<u16>(ino[i]);
+        inodes.sync(ctx, p, true);
+        inodes.unlock(p);
+        inodes.put(ctx, p);
+    }
+    mock.end_op(ctx);
+}
+
+void test_collision() {
+    // numbers that are `INODE_NUM_BUCKETS` apart fall into the same bucket.
+    constexpr usize num_files = 4;
+    usize all[(num_files - 1) * INODE_NUM_BUCKETS + 1], ino[num_files];
+    alloc_linked(all, std::size(all));
+    for (usize i = 0; i < num_files; i++) {
+        ino[i] = all[i * INODE_NUM_BUCKETS];
+        assert_eq(ino[i] % INODE_NUM_BUCKETS, ino[0] % INODE_NUM_BUCKETS);
+    }
+
+    constexpr usize num_workers = 4;
+    constexpr usize num_rounds = 1000;
+    std::vector<std::thread> workers;
+    for (usize i = 0; i < num_workers; i++) {
+        workers.emplace_back([&, i] {
+            OpContext ctx;
+            std::mt19937 gen(0x2333 + i);
+            for (usize j = 0; j < num_rounds; j++) {
+                usize k = gen() % num_files;
+                auto *p = inodes.get(ino[k]);
+                auto *q = inodes.share(p);
+                assert_eq(p->inode_no, ino[k]);
+
+                inodes.lock(p);
+                assert_eq(p->entry.type, INODE_REGULAR);
+                assert_eq(p->entry.minor, static_cast<u16>(ino[k]));
+                inodes.unlock(p);
+
+                mock.begin_op(&ctx);
+                inodes.put(&ctx, q);
+                inodes.put(&ctx, p);
+                mock.end_op(&ctx);
+            }
+        });
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    // one in-memory inode per number.
+    Inode *p[num_files];
+    for (usize i = 0; i < num_files; i++) {
+        p[i] = inodes.get(ino[i]);
+        assert_eq(p[i]->inode_no, ino[i]);
+        for (usize j = 0; j < i; j++) {
+            assert_ne(p[i], p[j]);
+        }
+    }
+
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_files; i++) {
+        assert_eq(p[i]->rc.count, 1);
+        inodes.put(ctx, p[i]);
+    }
+    mock.end_op(ctx);
+
+    for (usize i = 0; i < num_files; i++) {
+        assert_eq(mock.inspect(ino[i])->num_links, 1);
+    }
+}
+
+void test_lru() {
+    usize ino;
+    alloc_linked(&ino, 1);
+
+    // `alloc_linked` has loaded it, and the last `put` kept it in memory.
+    auto *p = inodes.get(ino);
+    assert_true(p->valid);
+
+    // it is not read from disk again.
+    mock.inspect(ino)->minor = 0;
+    inodes.lock(p);
+    assert_eq(p->entry.minor, static_cast<u16>(ino));
+    inodes.unlock(p);
+
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    assert_eq(inodes.get(ino), p);
+    assert_eq(p->rc.count, 1);
+    assert_true(p->valid);
+}
+
+void test_lru_bound() {
+    constexpr usize num_files = INODE_CACHE_SIZE + 8;
+    usize ino[num_files];
+    alloc_linked(ino, num_files);
+
+    // only the last `INODE_CACHE_SIZE` files put are still in memory.
+    Inode *p[num_files];
+    for (usize i = 0; i < num_files; i++) {
+        p[i] = inodes.get(ino[i]);
+        assert_eq(p[i]->valid, i >= num_files - INODE_CACHE_SIZE);
+    }
+
+    mock.begin_op(ctx);
+    for (usize i = 0; i < num_files; i++) {
+        inodes.put(ctx, p[i]);
+    }
+    mock.end_op(ctx);
+
+    for (usize i = 0; i < num_files; i++) {
+        p[i] = inodes.get(ino[i]);
+        assert_eq(p[i]->valid, i >= num_files - INODE_CACHE_SIZE);
+    }
+}
+
+void test_dcache_insert() {
+    usize ino;
+    alloc_linked(&ino, 1);
+
+    auto *p = inodes.get(ROOT_INODE_NO);
+    inodes.lock(p);
+
+    // the miss is cached, and `insert` must invalidate it.
+    assert_eq(inodes.lookup(p, "alice", NULL), 0);
+    assert_eq(inodes.lookup(p, "alice", NULL), 0);
+
+    mock.begin_op(ctx);
+    usize index = inodes.insert(ctx, p, "alice", ino);
+    mock.end_op(ctx);
+
+    usize index2 = 233;
+    assert_eq(inodes.lookup(p, "alice", &index2), ino);
+    assert_eq(index2, index);
+    assert_eq(inodes.lookup(p, "bob", NULL), 0);
+
+    inodes.unlock(p);
+}
+
+void test_dcache_unlink() {
+    usize ino[2];
+    alloc_linked(ino, 2);
+
+    auto *p = inodes.get(ROOT_INODE_NO);
+    inodes.lock(p);
+
+    mock.begin_op(ctx);
+    inodes.insert(ctx, p, "alice", ino[0]);
+    usize index = inodes.insert(ctx, p, "bob", ino[1]);
+    mock.end_op(ctx);
+    assert_eq(inodes.lookup(p, "bob", NULL), ino[1]);
+
+    // unlink "bob" in the same way as `sys_unlink`.
+    auto *q = inodes.get(ino[1]);
+    mock.begin_op(ctx);
+    inodes.remove(ctx, p, index);
+    inodes.lock(q);
+    q->entry.num_links--;
+    inodes.sync(ctx, q, true);
+    inodes.unlock(q);
+    inodes.put(ctx, q);
+    mock.end_op(ctx);
+
+    assert_eq(mock.inspect(ino[1])->type, INODE_INVALID);
+    assert_eq(inodes.lookup(p, "bob", NULL), 0);
+    assert_eq(inodes.lookup(p, "alice", NULL), ino[0]);
+
+    // the freed number is reused, but the old name must not point to it.
+    mock.begin_op(ctx);
+    assert_eq(inodes.alloc(ctx, INODE_REGULAR), ino[1]);
+    mock.end_op(ctx);
+    assert_eq(inodes.lookup(p, "bob", NULL), 0);
+
+    inodes.unlock(p);
+}
+
+// fill `n` bytes at `buf` with random data.
+static void fill_random(u8 *buf, usize n, u32 seed) {
+    std::mt19937 gen(seed);
+    for (usize i = 0; i < n; i++) {
+        buf[i] = gen() & 0xff;
+    }
+}
+
+// check that file `ino` has `num_blocks` contiguous blocks holding `copy`.
+static void check_flushed(usize ino, usize num_blocks, const u8 *copy) {
+    auto *q = mock.inspect(ino);
+    assert_eq(q->num_bytes, num_blocks * BLOCK_SIZE);
+    for (usize i = 0; i < num_blocks; i++) {
+        assert_eq(q->addrs[i], q->addrs[0] + i);
+        u8 *data = mock.inspect_block(q->addrs[i]);
+        for (usize j = 0; j < BLOCK_SIZE; j++) {
+            assert_eq(data[j], copy[i * BLOCK_SIZE + j]);
+        }
+    }
+}
+
+void test_delay_put() {
+    constexpr usize num_blocks = INODE_DELAY_MAX_BLOCKS / 2;
+    u8 buf[num_blocks * BLOCK_SIZE], copy[num_blocks * BLOCK_SIZE];
+    fill_random(copy, sizeof(copy), 0x19260817);
+
+    usize ino;
+    alloc_linked(&ino, 1);
+    auto *p = inodes.get(ino);
+    inodes.lock(p);
+    for (usize i = 0; i < num_blocks; i++) {
+        mock.begin_op(ctx);
+        inodes.write(ctx, p, copy + i * BLOCK_SIZE, i * BLOCK_SIZE, BLOCK_SIZE);
+        mock.end_op(ctx);
+    }
+
+    // nothing is on disk yet, but reads see the data.
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(mock.inspect(ino)->num_bytes, 0);
+    inodes.read(p, buf, 0, sizeof(buf));
+    for (usize i = 0; i < sizeof(buf); i++) {
+        assert_eq(buf[i], copy[i]);
+    }
+    inodes.unlock(p);
+
+    mock.begin_op(ctx);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+
+    assert_eq(mock.count_blocks(), num_blocks);
+    check_flushed(ino, num_blocks, copy);
+}
+
+void test_delay_sync() {
+    constexpr usize num_blocks = INODE_DELAY_MAX_BLOCKS / 2;
+    u8 copy[2][num_blocks * BLOCK_SIZE];
+    usize ino[2];
+    Inode *p[2];
+
+    alloc_linked(ino, 2);
+    for (usize k = 0; k < 2; k++) {
+        fill_random(copy[k], sizeof(copy[k]), static_cast<u32>(ino[k]));
+        p[k] = inodes.get(ino[k]);
+    }
+
+    // appends to the two files are interleaved, but each still gets one extent.
+    for (usize i = 0; i < num_blocks; i++) {
+        for (usize k = 0; k < 2; k++) {
+            mock.begin_op(ctx);
+            inodes.lock(p[k]);
+            inodes.write(ctx, p[k], copy[k] + i * BLOCK_SIZE, i * BLOCK_SIZE, BLOCK_SIZE);
+            inodes.unlock(p[k]);
+            mock.end_op(ctx);
+        }
+    }
+    assert_eq(mock.count_blocks(), 0);
+
+    inodes.flush_all();
+
+    assert_eq(mock.count_blocks(), 2 * num_blocks);
+    for (usize k = 0; k < 2; k++) {
+        check_flushed(ino[k], num_blocks, copy[k]);
+        assert_true(p[k]->delay_data == NULL);
+    }
+}
+
+void test_delay_defer() {
+    constexpr usize num_blocks = INODE_DELAY_MAX_BLOCKS / 2;
+    u8 copy[num_blocks * BLOCK_SIZE];
+    fill_random(copy, sizeof(copy), 0x20220115);
+
+    usize ino;
+    alloc_linked(&ino, 1);
+    auto *p = inodes.get(ino);
+    mock.begin_op(ctx);
+    inodes.lock(p);
+    inodes.write(ctx, p, copy, 0, sizeof(copy));
+    inodes.unlock(p);
+    mock.end_op(ctx);
+
+    // no log entry is reserved, so the last reference is kept.
+    mock.begin_op(ctx, 0);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_blocks(), 0);
+    assert_eq(p->rc.count, 1);
+
+    inodes.flush_all();
+
+    assert_eq(mock.count_blocks(), num_blocks);
+    check_flushed(ino, num_blocks, copy);
+}
+
+void test_free_defer() {
+    mock.begin_op(ctx);
+    usize ino = inodes.alloc(ctx, INODE_REGULAR);
+    mock.end_op(ctx);
+    assert_eq(mock.count_inodes(), 2);
+
+    auto *p = inodes.get(ino);
+    inodes.lock(p);
+    inodes.unlock(p);
+    assert_eq(inodes.put_log_blocks(p), INODE_FREE_LOG_BLOCKS);
+
+    // too few log entries are reserved to free it.
+    mock.begin_op(ctx, INODE_FREE_LOG_BLOCKS - 1);
+    inodes.put(ctx, p);
+    mock.end_op(ctx);
+    assert_eq(mock.count_inodes(), 2);
+
+    inodes.flush_all();
+    assert_eq(mock.count_inodes(), 1);
+}
+
 }  // namespace adhoc
 
 int main() {
@@ -412,6 +813,17 @@ int main() {
         {"small_file", adhoc::test_small_file},
         {"large_file", adhoc::test_large_file},
         {"dir", adhoc::test_dir},
+        {"reuse", adhoc::test_reuse},
+        {"create_unlink", adhoc::test_create_unlink},
+        {"collision", adhoc::test_collision},
+        {"lru", adhoc::test_lru},
+        {"lru_bound", adhoc::test_lru_bound},
+        {"dcache_insert", adhoc::test_dcache_insert},
+        {"dcache_unlink", adhoc::test_dcache_unlink},
+        {"delay_put", adhoc::test_delay_put},
+        {"delay_sync", adhoc::test_delay_sync},
+        {"delay_defer", adhoc::test_delay_defer},
+        {"free_defer", adhoc::test_free_defer},
     };
     Runner(tests).run();
 
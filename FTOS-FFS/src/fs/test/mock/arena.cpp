@@ -26,7 +26,9 @@ void *kalloc() {
 }
 
 void kfree(void *ptr) {
-    free(ref[reinterpret_cast<u8 *>(ptr)]);
+    u8 *q = reinterpret_cast<u8 *>(ptr);
+    free(ref[q]);
+    ref.remove(q);
 }
 
 void init_arena(Arena *arena, usize object_size, ArenaPageAllocator allocator [[maybe_unused]]) {
@@ -63,19 +63,28 @@ struct MockBlockDevice {
             throw Internal("logging area is too small");
         disk[sblock->log_start].fill_zero();
 
-        usize num_bitmap_blocks = (sblock->num_data_blocks + BIT_PER_BLOCK - 1) / BIT_PER_BLOCK;
-        for (usize i = 0; i < num_bitmap_blocks; i++) {
-            disk[sblock->bitmap_start + i].fill_zero();
+        // the mocked disk has only one block group, whose leading blocks (inode
+        // blocks, bitmap blocks and inode bitmap) are preallocated in its bitmap.
+        for (usize i = 0; i < sblock->num_bitmap_per_group; i++) {
+            disk[sblock->bg_start + sblock->bitmap_start_per_group + i].fill_zero();
         }
+        disk[sblock->bg_start + sblock->ibitmap_start_per_group].fill_zero();
 
-        usize num_preallocated = 1 + 1 + sblock->num_log_blocks +
-                                 ((sblock->num_inodes + INODE_PER_BLOCK - 1) / INODE_PER_BLOCK) +
-                                 num_bitmap_blocks;
-        if (num_preallocated + sblock->num_data_blocks > sblock->num_blocks)
+        if (sblock->data_start_per_group + sblock->num_datablocks_per_group >
+                sblock->blocks_per_group ||
+            sblock->bg_start + sblock->num_groups * sblock->blocks_per_group > sblock->num_blocks)
             throw Internal("invalid super block");
-        for (usize i = 0; i < num_preallocated; i++) {
+        for (usize i = 0; i < sblock->data_start_per_group; i++) {
             usize j = i / BIT_PER_BLOCK, k = i % BIT_PER_BLOCK;
-            disk[sblock->bitmap_start + j].data[k / 8] |= (1 << (k % 8));
+            disk[sblock->bg_start + sblock->bitmap_start_per_group + j].data[k / 8] |= (1 << (k % 8));
+        }
+
+        // all data blocks and inodes are free in the group descriptor table.
+        disk[sblock->gdt_start].fill_zero();
+        auto *desc = reinterpret_cast<GroupDesc *>(disk[sblock->gdt_start].data);
+        for (usize i = 0; i < sblock->num_groups; i++) {
+            desc[i].num_free_blocks = sblock->num_datablocks_per_group;
+            desc[i].num_free_inodes = sblock->num_inodes / sblock->num_groups;
         }
     }
 
@@ -3,7 +3,7 @@
 #include "block_device.hpp"
 
 static MockBlockDevice mock;
-static const SuperBlock sblock;
+static SuperBlock sblock;
 static BlockDevice device;
 
 static void stub_read(usize block_no, u8 *buffer) {
@@ -14,23 +14,61 @@ static void stub_write(usize block_no, u8 *buffer) {
     mock.write(block_no, buffer);
 }
 
+// requests are completed right away, in the order of submission.
+static void stub_submit(BlockRequest **reqs, usize count) {
+    for (usize i = 0; i < count; i++) {
+        BlockRequest *req = reqs[i];
+        req->done = false;
+        if (req->write)
+            mock.write(req->block_no, req->buffer);
+        else
+            mock.read(req->block_no, req->buffer);
+        if (req->callback)
+            req->callback(req);
+        req->done = true;
+    }
+}
+
+static bool stub_poll(BlockRequest *req) {
+    return req->done;
+}
+
+static void stub_wait(BlockRequest *req) {
+    if (!req->done)
+        throw Internal("waiting for a request that is not submitted");
+}
+
 static void initialize_mock(  //
     usize log_size,
     usize num_data_blocks,
     const std::string &image_path = "") {
+    usize num_bitmap_blocks = 1;
+    while (num_bitmap_blocks * BIT_PER_BLOCK < 2 + num_bitmap_blocks + num_data_blocks)
+        num_bitmap_blocks++;
+
     sblock.log_start = 2;
-    sblock.inode_start = sblock.log_start + 1 + log_size;
-    sblock.bitmap_start = sblock.inode_start + 1;
+    // the block cache keeps one more log block for the group descriptor table.
+    sblock.gdt_start = sblock.log_start + 2 + log_size;
+    sblock.bg_start = sblock.gdt_start + 1;
     sblock.num_inodes = 1;
-    sblock.num_log_blocks = 1 + log_size;
-    sblock.num_data_blocks = num_data_blocks;
-    sblock.num_blocks = 1 + 1 + 1 + log_size + 1 +
-                        ((num_data_blocks + BIT_PER_BLOCK - 1) / BIT_PER_BLOCK) + num_data_blocks;
+    sblock.num_log_blocks = 2 + log_size;
+    sblock.num_groups = 1;
+    sblock.num_inodeblocks_per_group = 1;
+    sblock.num_bitmap_per_group = num_bitmap_blocks;
+    sblock.num_datablocks_per_group = num_data_blocks;
+    sblock.bitmap_start_per_group = 1;
+    sblock.ibitmap_start_per_group = 1 + num_bitmap_blocks;
+    sblock.data_start_per_group = 2 + num_bitmap_blocks;
+    sblock.blocks_per_group = 2 + num_bitmap_blocks + num_data_blocks;
+    sblock.num_blocks = sblock.bg_start + sblock.blocks_per_group;
 
     mock.initialize(sblock);
 
     device.read = stub_read;
     device.write = stub_write;
+    device.submit = stub_submit;
+    device.poll = stub_poll;
+    device.wait = stub_wait;
 
     if (!image_path.empty())
         mock.load(image_path);
@@ -1,6 +1,7 @@
 #pragma once
 
 extern "C" {
+#include <common/bitmap.h>
 #include <fs/inode.h>
 }
 
@@ -12,24 +13,44 @@ extern "C" {
 
 #include "../exception.hpp"
 
+// the mocked disk has one block group:
+// [ MBR | super | log | group descriptor table | inode blocks | bitmap | inode bitmap | data ]
 struct MockBlockCache {
     static constexpr usize num_blocks = 2000;
+    static constexpr usize gdt_start = 52;
     static constexpr usize inode_start = 200;
+    static constexpr usize bitmap_start = 900;
+    static constexpr usize ibitmap_start = 901;
     static constexpr usize block_start = 1000;
     static constexpr usize num_inodes = 1000;
 
     static auto get_sblock() -> SuperBlock {
         SuperBlock sblock;
         sblock.num_blocks = num_blocks;
-        sblock.num_data_blocks = num_blocks - block_start;
-        sblock.num_inodes = num_inodes;
         sblock.num_log_blocks = 50;
+        sblock.num_groups = 1;
+        sblock.num_inodes = num_inodes;
+        sblock.blocks_per_group = num_blocks - inode_start;
         sblock.log_start = 2;
-        sblock.inode_start = inode_start;
-        sblock.bitmap_start = 900;
+        sblock.gdt_start = gdt_start;
+        sblock.bg_start = inode_start;
+        sblock.num_inodeblocks_per_group = (num_inodes - 1) / INODE_PER_BLOCK + 1;
+        sblock.num_bitmap_per_group = 1;
+        sblock.num_datablocks_per_group = num_blocks - block_start;
+        sblock.bitmap_start_per_group = bitmap_start - inode_start;
+        sblock.ibitmap_start_per_group = ibitmap_start - inode_start;
+        sblock.data_start_per_group = block_start - inode_start;
         return sblock;
     }
 
+    // on-disk location of inode `i`, in the same way as `fs/inode.c`.
+    static auto inode_block_no(usize i) -> usize {
+        return inode_start + (i - 1) / INODE_PER_BLOCK;
+    }
+    static auto inode_offset(usize i) -> usize {
+        return i % INODE_PER_BLOCK;
+    }
+
     struct Meta {
         bool mark = false;
         std::mutex mutex;
@@ -105,9 +126,9 @@ struct MockBlockCache {
             sblk[1].block.data[i] = buf[i];
         }
 
-        // mock inodes.
-        InodeEntry node[num_inodes];
-        for (usize i = 0; i < num_inodes; i++) {
+        // mock inodes. Inode numbers start from 1.
+        InodeEntry node[num_inodes + 1];
+        for (usize i = 1; i <= num_inodes; i++) {
             node[i].type = INODE_INVALID;
             node[i].major = gen() & 0xffff;
             node[i].minor = gen() & 0xffff;
@@ -130,14 +151,20 @@ struct MockBlockCache {
         }
         node[1].indirect = 0;
 
-        usize step = 0;
-        for (usize i = 0, j = inode_start; i < num_inodes; i += step, j++) {
-            step = std::min(num_inodes - i, static_cast<usize>(INODE_PER_BLOCK));
-            buf = reinterpret_cast<u8 *>(&node[i]);
-            for (usize k = 0; k < step * sizeof(InodeEntry); k++) {
-                sblk[j].block.data[k] = buf[k];
-            }
+        for (usize i = 1; i <= num_inodes; i++) {
+            *inspect(i) = node[i];
         }
+
+        // mock inode bitmap, where only the root inode is used.
+        sblk[ibitmap_start].zero();
+        sblk[ibitmap_start].block.data[0] = 1;
+
+        // mock group descriptor table.
+        sblk[gdt_start].zero();
+        auto *desc = reinterpret_cast<GroupDesc *>(sblk[gdt_start].block.data);
+        desc->num_free_blocks = static_cast<u32>(num_blocks - block_start);
+        desc->num_free_inodes = static_cast<u32>(num_inodes - 1);
+        desc->num_dirs = 1;
     }
 
     // invalidate all cached blocks and fill them with random data.
@@ -162,14 +189,10 @@ struct MockBlockCache {
     auto count_inodes() -> usize {
         std::unique_lock lock(mutex);
 
-        usize step = 0, count = 0;
-        for (usize i = 0, j = inode_start; i < num_inodes; i += step, j++) {
-            step = std::min(num_inodes - i, static_cast<usize>(INODE_PER_BLOCK));
-            auto *inodes = reinterpret_cast<InodeEntry *>(sblk[j].block.data);
-            for (usize k = 0; k < step; k++) {
-                if (inodes[k].type != INODE_INVALID)
-                    count++;
-            }
+        usize count = 0;
+        for (usize i = 1; i <= num_inodes; i++) {
+            if (inspect(i)->type != INODE_INVALID)
+                count++;
         }
 
         return count;
@@ -191,10 +214,25 @@ struct MockBlockCache {
 
     // inspect on disk inode at specified inode number.
     auto inspect(usize i) -> InodeEntry * {
-        usize j = inode_start + i / INODE_PER_BLOCK;
-        usize k = i % INODE_PER_BLOCK;
-        auto *arr = reinterpret_cast<InodeEntry *>(sblk[j].block.data);
-        return &arr[k];
+        auto *arr = reinterpret_cast<InodeEntry *>(sblk[inode_block_no(i)].block.data);
+        return &arr[inode_offset(i)];
+    }
+
+    // inspect the data of on-disk block `i`.
+    auto inspect_block(usize i) -> u8 * {
+        return sblk[i].block.data;
+    }
+
+    // is inode `i` marked as used in the on-disk inode bitmap?
+    auto inspect_ibitmap(usize i) -> bool {
+        std::scoped_lock guard(sblk[ibitmap_start].mutex);
+        auto *bitmap = reinterpret_cast<BitmapCell *>(sblk[ibitmap_start].block.data);
+        return bitmap_get(bitmap, i - 1);
+    }
+
+    // inspect the on-disk group descriptor.
+    auto inspect_desc() -> GroupDesc * {
+        return reinterpret_cast<GroupDesc *>(sblk[gdt_start].block.data);
     }
 
     void check_block_no(usize i) {
@@ -231,8 +269,11 @@ struct MockBlockCache {
         }
     }
 
-    void begin_op(OpContext *ctx) {
+    // the mock has no log, so synced blocks are not counted in `ctx`.
+    void begin_op(OpContext *ctx, usize num_reserved = LOG_MAX_SIZE) {
         std::unique_lock lock(mutex);
+        ctx->num_reserved = num_reserved;
+        ctx->num_blocks = 0;
         ctx->ts = oracle.fetch_add(1);
         scoreboard[ctx->ts] = false;
     }
@@ -272,27 +313,65 @@ struct MockBlockCache {
         }
     }
 
+    // try to allocate block `i`. Return false if it is used.
+    auto try_alloc(OpContext *ctx, usize i) -> bool {
+        std::scoped_lock guard(mbit[i].mutex, sbit[i].mutex);
+        load(mbit[i], sbit[i]);
+        if (mbit[i].used)
+            return false;
+
+        mbit[i].used = true;
+        if (!ctx)
+            store(mbit[i], sbit[i]);
+
+        std::scoped_lock guard2(mblk[i].mutex, sblk[i].mutex);
+        load(mblk[i], sblk[i]);
+        mblk[i].zero();
+        if (!ctx)
+            store(mblk[i], sblk[i]);
+
+        return true;
+    }
+
     auto alloc(OpContext *ctx) -> usize {
         for (usize i = block_start; i < num_blocks; i++) {
-            std::scoped_lock guard(mbit[i].mutex, sbit[i].mutex);
-            load(mbit[i], sbit[i]);
+            if (try_alloc(ctx, i))
+                return i;
+        }
 
-            if (!mbit[i].used) {
-                mbit[i].used = true;
-                if (!ctx)
-                    store(mbit[i], sbit[i]);
+        throw AssertionFailure("no free block");
+    }
 
-                std::scoped_lock guard(mblk[i].mutex, sblk[i].mutex);
-                load(mblk[i], sblk[i]);
-                mblk[i].zero();
-                if (!ctx)
-                    store(mblk[i], sblk[i]);
+    // there is only one block group, so `gno` is ignored.
+    auto allocg(OpContext *ctx, usize goal) -> usize {
+        usize start = goal >= block_start && goal < num_blocks ? goal : block_start;
+        for (usize i = start; i < num_blocks; i++) {
+            if (try_alloc(ctx, i))
+                return i;
+        }
+        for (usize i = block_start; i < start; i++) {
+            if (try_alloc(ctx, i))
+                return i;
+        }
+        return 0;
+    }
 
+    auto alloc_extent(OpContext *ctx, usize goal, usize min, usize max, usize *n) -> usize {
+        usize start = goal >= block_start && goal < num_blocks ? goal : block_start;
+        for (usize i = start; i < num_blocks; i++) {
+            usize k = 0;
+            while (k < max && i + k < num_blocks && try_alloc(ctx, i + k)) {
+                k++;
+            }
+            if (k >= min) {
+                *n = k;
                 return i;
             }
+            for (usize j = 0; j < k; j++) {
+                free(ctx, i + j);
+            }
         }
-
-        throw AssertionFailure("no free block");
+        return 0;
     }
 
     void free(OpContext *ctx, usize i) {
@@ -321,6 +400,12 @@ struct MockBlockCache {
         return &mblk[i].block;
     }
 
+    auto acquire_zeroed(usize i) -> Block * {
+        auto *b = acquire(i);
+        memset(b->data, 0, BLOCK_SIZE);
+        return b;
+    }
+
     void release(Block *b) {
         auto *p = check_and_get_cell(b);
         p->mutex.unlock();
@@ -6,8 +6,8 @@ static MockBlockCache mock;
 static SuperBlock sblock;
 static BlockCache cache;
 
-static void stub_begin_op(OpContext *ctx) {
-    mock.begin_op(ctx);
+static void stub_begin_op(OpContext *ctx, usize num_blocks) {
+    mock.begin_op(ctx, num_blocks);
 }
 
 static void stub_end_op(OpContext *ctx) {
@@ -18,6 +18,20 @@ static usize stub_alloc(OpContext *ctx) {
     return mock.alloc(ctx);
 }
 
+static usize stub_allocg(OpContext *ctx, u32 gno, usize goal) {
+    (void)gno;
+    return mock.allocg(ctx, goal);
+}
+
+static usize stub_alloc_extent(OpContext *ctx, usize goal, usize min, usize max, usize *num_blocks) {
+    return mock.alloc_extent(ctx, goal, min, max, num_blocks);
+}
+
+static void stub_prefetch(const usize *block_nos, usize count) {
+    (void)block_nos;
+    (void)count;
+}
+
 static void stub_free(OpContext *ctx, usize block_no) {
     mock.free(ctx, block_no);
 }
@@ -26,6 +40,10 @@ static Block *stub_acquire(usize block_no) {
     return mock.acquire(block_no);
 }
 
+static Block *stub_acquire_zeroed(usize block_no) {
+    return mock.acquire_zeroed(block_no);
+}
+
 static void stub_release(Block *block) {
     return mock.release(block);
 }
@@ -41,9 +59,14 @@ static struct _Loader {
         cache.begin_op = stub_begin_op;
         cache.end_op = stub_end_op;
         cache.alloc = stub_alloc;
+        cache.allocg = stub_allocg;
+        cache.alloc_extent = stub_alloc_extent;
+        cache.prefetch = stub_prefetch;
         cache.free = stub_free;
         cache.acquire = stub_acquire;
+        cache.acquire_zeroed = stub_acquire_zeroed;
         cache.release = stub_release;
         cache.sync = stub_sync;
+        cache.sync_data = stub_sync;
     }
 } _loader;
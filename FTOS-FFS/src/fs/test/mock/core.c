@@ -1,4 +1,7 @@
+#include <time.h>
+
 #include <core/sched.h>
+#include <driver/clock.h>
 
 struct cpu cpus[NCPU];
 
@@ -15,3 +18,9 @@ isize console_read(Inode *ip, char *dst, isize n) {
     (void)n;
     return 0;
 }
+
+u64 get_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+}
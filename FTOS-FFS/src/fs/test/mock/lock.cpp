@@ -14,6 +14,13 @@ struct Mutex {
         locked = true;
     }
 
+    bool try_lock() {
+        if (!mutex.try_lock())
+            return false;
+        locked = true;
+        return true;
+    }
+
     void unlock() {
         locked = false;
         mutex.unlock();
@@ -39,6 +46,10 @@ void init_spinlock(struct SpinLock *lock, const char *name [[maybe_unused]]) {
     mtx_map.try_add(lock);
 }
 
+bool try_acquire_spinlock(struct SpinLock *lock) {
+    return mtx_map[lock].try_lock();
+}
+
 void acquire_spinlock(struct SpinLock *lock) {
     mtx_map[lock].lock();
 }
@@ -3,6 +3,8 @@
 
 #define u32 unsigned int
 
+// 各块组已使用的数据块数，由`cache.c`中对应块组的锁保护
+// 其他模块只将其作为分配提示读取
 extern u32 used_block[NGROUPS];
 
 #endif
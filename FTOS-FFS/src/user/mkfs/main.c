@@ -33,10 +33,10 @@ struct xv6_stat;
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 // FFS disk layout:
-// [ MBR Block | super block | log blocks | block groups ]
+// [ MBR Block | super block | log blocks | group descriptor table | block groups ]
 
-// [ inode blocks | bitmap blocks | data blocks | ... | inode blocks | bitmap blocks | data blocks ]
-// \---------------- block group ---------------/
+// [ inode blocks | bitmap blocks | inode bitmap | data blocks | ... ]
+// \------------------- block group -------------------/
 #define BSIZE BLOCK_SIZE
 #define LOGSIZE LOG_MAX_SIZE
 #define NDIRECT INODE_NUM_DIRECT
@@ -44,22 +44,26 @@ struct xv6_stat;
 #define DIRSIZ FILE_NAME_MAX_LENGTH
 
 #define IPB (BSIZE / sizeof(InodeEntry))
-#define BPG ((FSSIZE - 2 - LOGSIZE) / NGROUPS)
+// 块组描述符表只占一个块
+#define NGDT 1
+#define BPG ((FSSIZE - 2 - LOGSIZE - NGDT) / NGROUPS)
 #define NIPG (NINODES / NGROUPS)
 #define NINBLOCKS_PER_GROUP (NINDIRECT / (NGROUPS - 1 ) * 2 + 1)
 
 #define IBLOCK(i, sb) (sb.bg_start + BPG * ((i - 1) / NIPG) + ((i - 1) % NIPG) / IPB)
 #define IGROUP(i, sb) ((i - 1) / NIPG)
-#define BGROUP(b, sb) ((b - 2 - LOG_MAX_SIZE) / BPG) 
+#define BGROUP(b, sb) ((b - 2 - LOG_MAX_SIZE - NGDT) / BPG) 
 
 int blocks_per_group = BPG;
 int ninodeblocks_per_group = (NINODES / NGROUPS) / IPB + 1;
 int nbitmap_per_group = BPG / (BIT_PER_BLOCK) + 1;
+// 每个块组有一个inode位图块
+int nibitmap_per_group = 1;
 
 // int nbitmap = FSSIZE / (BSIZE * 8) + 1;
 // int ninodeblocks = NINODES / IPB + 1;
 int num_log_blocks = LOGSIZE;
-int nmeta;           // Number of meta blocks (boot, sb, num_log_blocks, inode, bitmap)
+int nmeta;           // Number of meta blocks (boot, sb, num_log_blocks, gdt, inode, bitmap)
 int num_data_blocks; // Number of data blocks
 /* 修改常量 */
 
@@ -69,6 +73,9 @@ char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 uint used_block[NGROUPS] = {0};
+// 各块组已使用的inode数和目录数，用于生成块组描述符表
+uint used_inode[NGROUPS] = {0};
+uint num_dirs[NGROUPS] = {0};
 
 // void balloc(int);
 void wsect(uint, void *);
@@ -80,6 +87,8 @@ void rblock(uint bnum, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
 void ballocg();
+void wgdt();
+void iballocg();
 
 // convert to little-endian byte order
 ushort xshort(ushort x)
@@ -111,6 +120,7 @@ int main(int argc, char *argv[])
     InodeEntry din;
 
     static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+    static_assert(NGROUPS <= GROUP_DESC_PER_BLOCK, "Group descriptors must fit in one block!");
 
     if (argc < 2)
     {
@@ -131,7 +141,8 @@ int main(int argc, char *argv[])
     /* 修改初始文件系统生成 */
     /* 修改超级块的初始化过程 */
     // 1 fs block = 1 disk sector
-    nmeta = 2 + num_log_blocks + ninodeblocks_per_group * NGROUPS + nbitmap_per_group * NGROUPS;
+    nmeta = 2 + num_log_blocks + NGDT + ninodeblocks_per_group * NGROUPS + nbitmap_per_group * NGROUPS +
+            nibitmap_per_group * NGROUPS;
     num_data_blocks = FSSIZE - nmeta;
 
     // sb.num_blocks = xint(FSSIZE);
@@ -149,13 +160,15 @@ int main(int argc, char *argv[])
     sb.blocks_per_group = xint(blocks_per_group);
 
     sb.log_start = xint(2);
-    sb.bg_start = xint(2 + num_log_blocks);
+    sb.gdt_start = xint(2 + num_log_blocks);
+    sb.bg_start = xint(2 + num_log_blocks + NGDT);
 
     sb.num_inodeblocks_per_group = xint(ninodeblocks_per_group);
     sb.num_bitmap_per_group = xint(nbitmap_per_group);
-    sb.num_datablocks_per_group = xint(blocks_per_group - ninodeblocks_per_group - nbitmap_per_group);
+    sb.num_datablocks_per_group = xint(blocks_per_group - ninodeblocks_per_group - nbitmap_per_group - nibitmap_per_group);
     sb.bitmap_start_per_group = xint(ninodeblocks_per_group);
-    sb.data_start_per_group = xint(ninodeblocks_per_group + nbitmap_per_group);
+    sb.ibitmap_start_per_group = xint(ninodeblocks_per_group + nbitmap_per_group);
+    sb.data_start_per_group = xint(ninodeblocks_per_group + nbitmap_per_group + nibitmap_per_group);
 
     // printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d "
     //        "total %d\n",
@@ -166,10 +179,11 @@ int main(int argc, char *argv[])
     //        num_data_blocks,
     //        FSSIZE);
 
-    printf("nmeta %d (boot, super, log blocks %u, inode blocks per group %u, bitmap blocks per group %u) data blocks %d "
+    printf("nmeta %d (boot, super, log blocks %u, gdt blocks %lu, inode blocks per group %u, bitmap blocks per group %u) data blocks %d "
            "total %lu\n",
            nmeta,
            num_log_blocks,
+           NGDT,
            ninodeblocks_per_group,
            nbitmap_per_group,
            num_data_blocks,
@@ -257,6 +271,10 @@ int main(int argc, char *argv[])
 
     // 更新位图
     ballocg();
+    // 更新inode位图
+    iballocg();
+    // 根据位图和inode的分配情况生成块组描述符表
+    wgdt();
 
     exit(0);
 }
@@ -346,6 +364,10 @@ uint ialloc(ushort type)
     din.num_links = xshort(1);
     din.num_bytes = xint(0);
     winode(inum, &din);
+
+    used_inode[IGROUP(inum, sb)]++;
+    if (type == INODE_DIRECTORY)
+        num_dirs[IGROUP(inum, sb)]++;
     return inum;
 }
 
@@ -394,6 +416,44 @@ void ballocg()
     }
 }
 
+// 根据used_inode数组更新各块组的inode位图
+// mkfs中inode顺序分配，因此每个块组中已使用的inode总是排在最前面
+void iballocg()
+{
+    uchar buf[BSIZE];
+    uint i;
+    int gno;
+
+    assert(NIPG <= BIT_PER_BLOCK);
+    for (gno = 0; gno < NGROUPS; gno++)
+    {
+        bzero(buf, BSIZE);
+        for (i = 0; i < used_inode[gno]; i++)
+        {
+            buf[i / 8] = buf[i / 8] | (0x1 << (i % 8));
+        }
+        wblock(sb.bg_start + sb.ibitmap_start_per_group + gno * BPG, buf);
+    }
+}
+
+// 将各块组的空闲块数、空闲inode数和目录数写入块组描述符表
+void wgdt()
+{
+    uchar buf[BSIZE];
+    GroupDesc *desc;
+    int gno;
+
+    bzero(buf, BSIZE);
+    for (gno = 0; gno < NGROUPS; gno++)
+    {
+        desc = (GroupDesc *)buf + gno;
+        desc->num_free_blocks = xint(sb.num_datablocks_per_group - used_block[gno]);
+        desc->num_free_inodes = xint(NIPG - used_inode[gno]);
+        desc->num_dirs = xint(num_dirs[gno]);
+    }
+    wblock(sb.gdt_start, buf);
+}
+
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
 // 将xp指向的大小为n的数据写入到inode为inum的data块中